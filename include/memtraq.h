@@ -47,6 +47,12 @@ memtraq_disable (void) MEMTRAQ_EXPORT;
 extern void
 memtraq_tag (const char* name) MEMTRAQ_EXPORT;
 
+extern void
+memtraq_context_push (const char* label) MEMTRAQ_EXPORT;
+
+extern void
+memtraq_context_pop (void) MEMTRAQ_EXPORT;
+
 #define MEMTRAQ_ENABLE() do { \
    if (memtraq_enable) {      \
       memtraq_enable ();      \
@@ -65,6 +71,18 @@ memtraq_tag (const char* name) MEMTRAQ_EXPORT;
    }                          \
 } while (0)
 
+#define MEMTRAQ_CONTEXT_PUSH(label) do { \
+   if (memtraq_context_push) {         \
+      memtraq_context_push (label);    \
+   }                                   \
+} while (0)
+
+#define MEMTRAQ_CONTEXT_POP() do { \
+   if (memtraq_context_pop) {      \
+      memtraq_context_pop ();      \
+   }                               \
+} while (0)
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
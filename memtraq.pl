@@ -21,17 +21,40 @@ use strict;
 use warnings;
 
 use Cwd 'abs_path';
+use Digest::MD5;
+use Fcntl qw(:flock);
 use File::Basename;
 use FileHandle;
+use File::Temp qw(tempfile);
 use Getopt::Long;
+use IO::Compress::Gzip qw(gzip $GzipError);
+use IO::Select;
+use IO::Socket::INET;
 use IPC::Open2;
+use IPC::Open3;
 use POSIX;
+use Storable qw(nfreeze nstore retrieve thaw);
 
 my $EV_START   = 0;
 my $EV_MALLOC  = 1;
 my $EV_FREE    = 2;
 my $EV_REALLOC = 3;
 my $EV_TAG     = 4;
+my $EV_MMAP    = 5;
+my $EV_MUNMAP  = 6;
+my $EV_MREMAP  = 7;
+my $EV_SBRK    = 8;
+my $EV_BRK     = 9;
+my $EV_CALLOC  = 10;
+my $EV_MEMALIGN = 11;
+my $EV_FREE_SIZED = 12;
+my $EV_CONTEXT = 13;
+
+# Flags of the INIT event (optional fields of the log)
+my $INIT_FLAG_LATENCY = 0x1;
+my $INIT_FLAG_CONTEXT = 0x2;
+
+my $ET_EXEC    = 2;
 
 my %opts;
 
@@ -54,35 +77,142 @@ my $graph_cols = 80;
 # Number of rows for graphs 
 my $graph_rows = 40;
 
+my $addr2line = 'addr2line';
+my $at = '';
 my $before = '';
 my $after = '';
+my $build_index = 0;
+my $cache_line = 64;
+my $checkpoint_interval = 1000000;
+my $checkpoint_seconds = 0;
+my $contexts = 0;
+my $cross_thread = 0;
+my $diff = '';
+my $diff_snapshot = '';
+my $false_sharing = 0;
+my $folded = '';
+my $folded_weight = 'live';
+my $follow = 0;
 my $gdb = 'gdb';
+my $index = '';
+my $interval = 5;
+my $jobs = 1;
+my $latency = 0;
+my $lifetimes = 0;
+my $listen = '';
 my $map = '';
+my $mappings = 0;
 my $node_fraction = 0.20;
 my $objdump = 'objdump';
+my $occupancy = 0;
 my $paths = '';
+my $realloc_chains = 0;
+my $peak_window = '';
+my $show_peak = 0;
+my $pprof = '';
+my $save = '';
 my $show_all = 0;
+my $snapshot = '';
 my $show_grouped = 0;
 my $show_unknown = 0;
+my $sparse_page = 1024;
+my $simulate = '';
+my $short_lived = 1000;
+my $size_classes = 'pow2';
+my $sizes = 0;
+my $symbol_cache = '';
+my $symbolizer = 'addr2line';
+my $top_count = 10;
+my $trace = '';
+my $trace_large = 0;
+my $trend_min_r2 = 0.8;
+my $trend_min_windows = 4;
+my $trend_window = 0;
 my $do_debug = 0;
 my $live_report = '';
 
 GetOptions(\%opts,
+   'addr2line-tool=s' => \$addr2line,
    'before|b=s' => \$before,
    'after|a=s' => \$after,
+   'at=s' => \$at,
+   'build-index' => \$build_index,
+   'cache-line=i' => \$cache_line,
+   'checkpoint-interval=i' => \$checkpoint_interval,
+   'checkpoint-seconds=f' => \$checkpoint_seconds,
+   'contexts' => \$contexts,
+   'cross-thread' => \$cross_thread,
    'debug|d' => \$do_debug,
+   'diff=s' => \$diff,
+   'diff-snapshot=s' => \$diff_snapshot,
+   'false-sharing' => \$false_sharing,
+   'folded=s' => \$folded,
+   'folded-weight=s' => \$folded_weight,
+   'follow|f' => \$follow,
    'gdb-tool=s' => \$gdb,
    'graph|g=s' => \$graph,
+   'index=s' => \$index,
+   'interval|i=i' => \$interval,
+   'jobs|j=i' => \$jobs,
+   'latency' => \$latency,
+   'lifetimes' => \$lifetimes,
+   'listen|l=s' => \$listen,
    'live-report=s' => \$live_report,
    'map|m=s' => \$map,
+   'mappings' => \$mappings,
    'node-fraction|n=f' => \$node_fraction,
    'objdump-tool=s' => \$objdump,
+   'occupancy' => \$occupancy,
    'paths|p=s' => \$paths,
+   'peak' => \$show_peak,
+   'peak-window=s' => \$peak_window,
+   'pprof=s' => \$pprof,
+   'realloc-chains' => \$realloc_chains,
+   'save=s' => \$save,
    'show-all|A' => \$show_all,
    'show-grouped|G' => \$show_grouped,
    'show-unknown|U' => \$show_unknown,
+   'simulate=s' => \$simulate,
+   'short-lived=i' => \$short_lived,
+   'size-classes=s' => \$size_classes,
+   'sizes' => \$sizes,
+   'snapshot=s' => \$snapshot,
+   'sparse-page=i' => \$sparse_page,
+   'symbol-cache=s' => \$symbol_cache,
+   'symbolizer=s' => \$symbolizer,
+   'top=i' => \$top_count,
+   'trace=s' => \$trace,
+   'trace-large=i' => \$trace_large,
+   'trend-min-r2=f' => \$trend_min_r2,
+   'trend-min-windows=i' => \$trend_min_windows,
+   'trend-window=f' => \$trend_window,
 );
 
+# Symbol cache may also be shared via the environment
+if (($symbol_cache eq '') && (defined ($ENV{'MEMTRAQ_SYMBOL_CACHE'}))) {
+   $symbol_cache = $ENV{'MEMTRAQ_SYMBOL_CACHE'};
+}
+
+if (($size_classes ne 'pow2') && ($size_classes ne 'exact')) {
+   die("Unknown size classes '" . $size_classes . "' (use pow2 or exact)!");
+}
+
+if (!grep { $_ eq $folded_weight } ('live', 'alloc-bytes', 'allocs', 'churn')) {
+   die("Unknown weight '" . $folded_weight . "' (use live, alloc-bytes, allocs or churn)!");
+}
+
+if ($cache_line <= 0) {
+   die("Invalid cache line size " . $cache_line . "!");
+}
+
+if (($symbolizer ne 'addr2line') && ($symbolizer ne 'gdb')) {
+   die("Unknown symbolizer '" . $symbolizer . "' (use addr2line or gdb)!");
+}
+
+if (($symbol_cache ne '') && (! -d $symbol_cache)) {
+   mkdir ($symbol_cache) or die("Could not create symbol cache " . $symbol_cache . "!");
+}
+
 sub debug {
    my $msg = $_[0];
    if ($do_debug) {
@@ -90,13 +220,42 @@ sub debug {
    }
 }
 
-my $file=$ARGV[0];
-open (LOG, '<', $file) or die("Could not open " . $file . "!");
+my $sock;
+if ($listen ne '') {
+   # Receive log entries from the target (see MEMTRAQ_TARGET)
+   $sock = IO::Socket::INET->new (Proto => 'udp', LocalPort => $listen)
+      or die("Could not listen on port " . $listen . "!");
+   $follow = 1;
+}
+else {
+   my $file=$ARGV[0];
+   open (LOG, '<', $file) or die("Could not open " . $file . "!");
+   binmode (LOG);
+
+   # Index of the log (see --build-index)
+   if ($index eq '') {
+      $index = $file . ".idx";
+   }
+}
+
+if ($build_index) {
+   if (($after ne '') || ($before ne '') || ($at ne '') || ($follow != 0)) {
+      die("--build-index cannot be used with --after, --before, --at, --follow or --listen!");
+   }
+   if ($checkpoint_interval <= 0) {
+      die("Invalid checkpoint interval " . $checkpoint_interval . "!");
+   }
+}
+
+# Keep a copy of the log entries received
+if ($save ne '') {
+   open (SAVE, '>', $save) or die("Could not open " . $save . "!");
+   binmode (SAVE);
+}
 
 my %maps;
 my %objects;
 my %hsyms;
-my $exec = '';
 
 # Load provided map file into the 'maps' array
 if ($map ne '') {
@@ -117,6 +276,10 @@ if ($map ne '') {
          $end    =~ s/ .*//;
          $line   =~ s/^[0-9a-f]+ +//;
 
+         # Extract offset of the region in the file
+         my $pgoff =  $line;
+         $pgoff    =~ s/^[^ ]+ +([0-9a-f]+) .*/$1/;
+
          # Extract path (eat everything up to the leading /)
          $line =~ s/[^\/]+//;
 
@@ -124,7 +287,9 @@ if ($map ne '') {
             $maps{$start}{'file'}    = $line;
             $maps{$start}{'start'}   = hex ($start);
             $maps{$start}{'end'}     = hex ($end);
+            $maps{$start}{'pgoff'}   = hex ($pgoff);
             $objects{$line}{'start'} = hex($start);
+            $objects{$line}{'pgoff'} = hex($pgoff);
             debug "added map entry '$line' $start-$end";
          }
       }
@@ -132,21 +297,50 @@ if ($map ne '') {
    close (MAP);
 }
 
+# Executable regions sorted by start address for object_from_addr()
+my @maps_index = sort { $a->{'start'} <=> $b->{'start'} } values %maps;
+
+# Objects already found for a given address (object_from_addr)
+my %objects_cache;
+
+# Index in maps_index of the region holding an address (-1 if none)
+sub map_entry_from_addr {
+   my $addr = $_[0];
+
+   # Binary search for the last region starting at or before the
+   # address, regions from a map file do not overlap
+   my $lo = 0;
+   my $hi = scalar (@maps_index) - 1;
+   while ($lo <= $hi) {
+      my $mid = ($lo + $hi) >> 1;
+      if ($maps_index[$mid]{'start'} <= $addr) {
+         $lo = $mid + 1;
+      }
+      else {
+         $hi = $mid - 1;
+      }
+   }
+   if (($hi >= 0) && ($addr <= $maps_index[$hi]{'end'})) {
+      return $hi;
+   }
+   return -1;
+}
+
 sub object_from_addr {
    my $a = $_[0];
    my $result = "unknown";
 
+   if (defined ($objects_cache{$a})) {
+      return $objects_cache{$a};
+   }
+
    if ($a =~ /^[0-9a-f]+$/) {
-      $a = hex ($a);
-      foreach my $m (keys %maps) {
-         my $start = $maps{$m}{'start'};
-         my $end   = $maps{$m}{'end'};
-         if (($start <= $a) && ($a <= $end)) {
-            $result = $maps{$m}{'file'};
-            return $result;
-         }
+      my $i = map_entry_from_addr (hex ($a));
+      if ($i >= 0) {
+         $result = $maps_index[$i]{'file'};
       }
    }
+   $objects_cache{$a} = $result;
    return $result;
 }
 
@@ -247,7 +441,10 @@ sub is_alloc_wrapper {
         || ($name eq 'WTF::tryFastRealloc(void*, size_t)'));
 }
 
-# provide call info on who called malloc (or alike)
+# provide call info on who called malloc (or alike): the first frame of
+# the callstack that is not an allocation wrapper. Returns an empty list
+# (and not undef, which would make a one-element hash) if the callstack
+# has no such frame.
 sub get_caller_info {
 
    my $btstr = $_[0];
@@ -258,639 +455,3982 @@ sub get_caller_info {
    foreach my $a (@bt) {
       if ($i > 0) {
          my %result = decode ($a);
-         if (defined $bt[$i]) {
-            if ((!is_alloc_wrapper ($result{'method'})) || (!defined ($bt[$i+1]))) {
-               return %result;
-            }
+         if ((!is_alloc_wrapper ($result{'method'})) || (!defined ($bt[$i+1]))) {
+            return %result;
          }
       }
       $i = $i + 1;
    }
-   return undef;
+   return ();
 }
 
-my %chunks;
-my $total = 0;
-my $allocs = 0;
-my $frees = 0;
-my %unknown_frees;
-my $reallocs = 0;
-my $log = 1;
-my %hotspots;
-my $lines = 0;
-my $current_serial = 0;
-my $logs_lost = 0;
+#----------------------------------------------------------------------------
+# Address decoding
+#----------------------------------------------------------------------------
 
-my @heap_history;
+# Read the type of an ELF file (ET_EXEC, ET_DYN, ...) from its header,
+# its PT_LOAD segments (file offset, virtual address and size in the file)
+# and its GNU build-id from its PT_NOTE segments
+sub elf_read {
+   my $file = $_[0];
+   my $type = 0;
+   my @loads;
+   my @notes;
+   my $build_id = '';
 
-if ($after ne '') {
-   print "# tracking on hold till tag '" . $after . "' (--after)...\n";
-   $log = 0;
-}
+   if (open (ELF, '<', $file)) {
+      binmode (ELF);
+      if (read (ELF, my $hdr, 64) >= 52) {
+         my ($magic, $class, $data) = unpack ('a4 C C', $hdr);
+         if ($magic eq "\x7fELF") {
+            my $e = ($data == 2) ? '>' : '<';
+            my ($phoff, $phentsize, $phnum);
+            $type = unpack ("S$e", substr ($hdr, 16, 2));
+            if ($class == 2) {
+               ($phoff) = unpack ("Q$e", substr ($hdr, 0x20, 8));
+               ($phentsize, $phnum) = unpack ("S$e S$e", substr ($hdr, 0x36, 4));
+            }
+            else {
+               ($phoff) = unpack ("L$e", substr ($hdr, 0x1c, 4));
+               ($phentsize, $phnum) = unpack ("S$e S$e", substr ($hdr, 0x2a, 4));
+            }
+            for (my $i = 0; $i < $phnum; $i++) {
+               my $ph;
+               seek (ELF, $phoff + ($i * $phentsize), 0);
+               last if (read (ELF, $ph, $phentsize) != $phentsize);
 
-binmode (LOG);
-while (read (LOG, my $data, 28)) {
+               my ($ptype, $offset, $vaddr, $filesz);
+               if ($class == 2) {
+                  ($ptype, $offset, $vaddr) = unpack ("L$e x4 Q$e Q$e", $ph);
+                  ($filesz) = unpack ("Q$e", substr ($ph, 0x20, 8));
+               }
+               else {
+                  ($ptype, $offset, $vaddr, $filesz) = unpack ("L$e L$e L$e x4 L$e", $ph);
+               }
+               push (@loads, [ $offset, $vaddr, $filesz ]) if ($ptype == 1); # PT_LOAD
+               push (@notes, [ $offset, $filesz ]) if ($ptype == 4); # PT_NOTE
+            }
 
-   my ($sz, $serial, $ev, $ts, $thread_id) = unpack 'IQIQI', $data;
-   $sz = $sz - 4 - 8 - 4 - 8 - 4;
+            foreach my $note (@notes) {
+               my ($offset, $size) = @{ $note };
+               my $notes;
+               seek (ELF, $offset, 0);
+               next if (read (ELF, $notes, $size) != $size);
+               while (length ($notes) >= 12) {
+                  my ($namesz, $descsz, $ntype) = unpack ("L$e L$e L$e", $notes);
+                  my $namelen = ($namesz + 3) & ~3;
+                  my $desclen = ($descsz + 3) & ~3;
+                  my $name = substr ($notes, 12, $namesz);
+                  # NT_GNU_BUILD_ID
+                  if (($ntype == 3) && ($name eq "GNU\0")) {
+                     $build_id = unpack ('H*', substr ($notes, 12 + $namelen, $descsz));
+                     last;
+                  }
+                  $notes = substr ($notes, 12 + $namelen + $desclen);
+               }
+               last if ($build_id ne '');
+            }
+         }
+      }
+      close (ELF);
+   }
+   return ($type, \@loads, $build_id);
+}
 
-   debug "LOG HEADER sz=$sz, serial=$serial, ev=$ev, ts=$ts, thread_id=$thread_id";
+# Get the ELF information of an object ('type', 'loads' and 'build_id'),
+# its file is only read once
+sub object_elf {
+   my $obj = $_[0];
 
-   # Initialize ts_min if this is the first log entry
-   $lines = $lines + 1;
-   if ($lines eq 1) {
-      $ts_min = $ts;
+   if (!defined ($objects{$obj}{'type'})) {
+      my $file = $objects{$obj}{'file'};
+      ($objects{$obj}{'type'}, $objects{$obj}{'loads'}, $objects{$obj}{'build_id'}) =
+         ((defined ($file)) && ($file ne '')) ? elf_read ($file) : (0, [], '');
    }
+}
 
-   if ($current_serial != 0) {
-      $current_serial = $current_serial + 1;
-      if ($serial > $current_serial) {
-         debug "received log #$serial, $current_serial expected!\n";
-         $logs_lost = $logs_lost + 1;
+# Load bias of an object: difference between its run-time addresses and
+# the addresses it was linked at. The executable region was mapped from
+# the file offset pgoff, which belongs to one of the PT_LOAD segments.
+sub object_bias {
+   my $obj = $_[0];
+   my $pgoff = $objects{$obj}{'pgoff'};
+
+   # Segments not starting on a page boundary are mapped from the start
+   # of their first page: use the first segment ending after pgoff
+   foreach my $load (sort { $a->[0] <=> $b->[0] } @{ $objects{$obj}{'loads'} || [] }) {
+      my ($offset, $vaddr, $filesz) = @{ $load };
+      if ($pgoff < $offset + $filesz) {
+         return $objects{$obj}{'start'} - ($vaddr - $offset + $pgoff);
       }
    }
-   else {
-      $current_serial = $serial;
+
+   # No segment found (e.g. not an ELF file), assume the segment is
+   # linked at its file offset
+   return $objects{$obj}{'start'} - $pgoff;
+}
+
+# Record decoded information for an address into 'hsyms'
+sub add_symbol {
+   my ($a, $obj, $method, $file, $num) = @_;
+   my $dir = '';
+   my $loc = sprintf ("%s: ??? [%s]", $a, basename ($obj));
+
+   if ($file ne '') {
+      $loc  = sprintf ("%s: %s <%s:%u> [%s]", $a, $method, $file, $num, basename ($obj));
+      $dir  = dirname ($file);
+      $file = basename ($file);
+   }
+   elsif ($method ne '') {
+      $loc = sprintf ("%s: %s [%s]", $a, $method, basename ($obj));
    }
 
-   # As memtraq logs are ordered chronogically, ts_max is the current ts
-   $ts_max = $ts;
+   $hsyms{$a}{'object'} = $obj;
+   $hsyms{$a}{'loc'}    = $loc;
+   $hsyms{$a}{'dir'}    = $dir;
+   $hsyms{$a}{'file'}   = $file;
+   $hsyms{$a}{'line'}   = $num;
+   $hsyms{$a}{'method'} = $method;
+   $hsyms{$a}{'path'}   = $_[3];
+}
 
-   # START event
-   if ($ev == $EV_START) {
-      read (LOG, $data, 4);
+# Record addresses of an object that could not be decoded
+sub add_unknown_symbols {
+   my $obj = $_[0];
+
+   foreach my $a (keys %{ $objects{$obj}{'addrs'} }) {
+      next if (defined ($hsyms{$a}));
+      add_symbol ($a, $obj, '', '', '');
    }
+}
 
-   # TAG event
-   if ($ev == $EV_TAG) {
+# Decode all the addresses of an object with a single run of addr2line.
+# Returns 0 if addr2line failed or did not decode every address (those
+# it decoded are kept).
+sub symbolize_addr2line {
+   my $obj   = $_[0];
+   my $file  = $objects{$obj}{'file'};
+   my @addrs = sort { hex ($a) <=> hex ($b) } keys %{ $objects{$obj}{'addrs'} };
 
-      # Extract tag name
-      read (LOG, $data, $sz);
-      my ($name, $serial) = unpack 'ZI', $sz;
+   # Shared objects are relocated: turn run-time addresses back into
+   # addresses relative to the object using its load bias
+   my $bias = 0;
+   if ($objects{$obj}{'type'} != $ET_EXEC) {
+      $bias = object_bias ($obj);
+   }
 
-      debug "LOG TAG name=$name, serial=$serial";
+   my ($tmp, $tmpname) = tempfile (UNLINK => 1);
+   foreach my $a (@addrs) {
+      printf $tmp ("%x\n", hex ($a) - $bias);
+   }
+   close ($tmp);
 
-      if ($before ne '') {
-         if ($before =~ /:\d+$/) {
-            my $before_name = $before;
-            $before_name =~ s/:\d+$//;
-            my $before_serial = $before;
-            $before_serial =~ s/[^:]+://;
-            if (($name eq $before_name) && ($serial == $before_serial)) {
-               print "# reached tag '" . $before . "' (--before), no longer tracking...\n";
-               $log = 0;
-            }
-         }
-         else {
-            if ($name eq $before) {
-               print "# reached tag '" . $before . "' (--before), no longer tracking...\n";
-               $log = 0;
-            }
+   # addr2line reads the addresses from the file as its standard input;
+   # it is run without a shell so that a missing tool makes open3() fail
+   my @cmd = ($addr2line, '-f', '-C', '-e', $file);
+   debug "addr2line command = @cmd < $tmpname";
+   if (!open (A2LIN, '<', $tmpname)) {
+      unlink ($tmpname);
+      return 0;
+   }
+   my $pid = eval { open3 ('<&A2LIN', \*A2L, '>&STDERR', @cmd) };
+   close (A2LIN);
+   if (!defined ($pid)) {
+      debug "could not run $addr2line: $@";
+      unlink ($tmpname);
+      return 0;
+   }
+
+   # addr2line prints two lines for each address: the function
+   # and then its location as file:line
+   my $decoded = 0;
+   foreach my $a (@addrs) {
+      my $method = <A2L>;
+      my $where  = <A2L>;
+      last if (!defined ($where));
+      $method =~ s/\n//;
+      $where  =~ s/\n//;
+      $where  =~ s/ \(discriminator \d+\)$//;
+      debug "<addr2line: $a '$method' '$where'";
+
+      my $file = '';
+      my $num  = '';
+      if ($where =~ /^(.+):(\d+)$/) {
+         if (($1 ne '??') && ($2 != 0)) {
+            $file = $1;
+            $num  = $2;
          }
       }
-      if ($after ne '') {
-         if ($after =~ /:\d+$/) {
-            my $after_name = $after;
-            $after_name =~ s/:\d+$//;
-            my $after_serial = $after;
-            $after_serial =~ s/[^:]+://;
-            if (($name eq $after_name) && ($serial == $after_serial)) {
-               print "# reached tag '" . $after . "' (--after), tracking resumed...\n";
-               $log = 1;
-            }
+      $method = '' if ($method eq '??');
+      add_symbol ($a, $obj, $method, $file, $num);
+      $decoded ++;
+   }
+   close (A2L);
+   waitpid ($pid, 0);
+   unlink ($tmpname);
+   if (($? != 0) || ($decoded < scalar (@addrs))) {
+      debug "$addr2line failed for $file (status $?), $decoded of " . scalar (@addrs) . " address(es) decoded";
+      return 0;
+   }
+   return 1;
+}
+
+# Decode all the addresses of the provided objects with gdb
+sub symbolize_gdb {
+   my $cmd = "$gdb --quiet";
+   debug "gdb command = $cmd";
+   my $pid = open2 (*RP, *WP, $cmd);
+   my $line;
+   foreach my $obj (@_) {
+      my $file   = $objects{$obj}{'file'};
+      my $start  = $objects{$obj}{'start'};
+      my $offset = $objects{$obj}{'offset'};
+      if ((defined ($start)) && (defined ($offset))) {
+         # the parent process has an offset of zero
+         if ($offset > 0) {
+            my $a = $start + $offset;
+            debug ">gdb: " . sprintf ("add-symbol-file $file 0x%x", $a);
+            print WP sprintf ("add-symbol-file $file 0x%x\n", $a);
          }
          else {
-            if ($name eq $after) {
-               print "# reached tag '" . $after . "' (--after), tracking resumed...\n";
-               $log = 1;
-            }
+            debug ">gdb: symbol-file $file";
+            print WP "symbol-file $file\n";
          }
-      }
-   }
 
-   # MALLOC event
-   if ($ev == $EV_MALLOC) {
+         # Skip all messages printed by gdb until "Reading symbols from"
+         do {
+            $line = <RP>;
+            $line =~ s/\n//;
+            debug ">gdb: $line";
+         } while ($line !~ /Reading symbols from/);
 
-      read (LOG, $data, 8);
-      my ($size, $ptr) = unpack 'II', $data;
-      $sz = $sz - 4 - 4;
+         # Loop for decoding all addresses we need from that object
+         for my $a ( keys %{ $objects{$obj}{'addrs'} } ) {
 
-      debug "LOG MALLOC size=$size, ptr=$ptr";
+            # Get gdb to resolve this address
+            debug ">gdb: info line *0x$a";
+            print WP "info line *0x$a\n";
+            $line = <RP>;
+            $line =~ s/\n//g;
+            debug "<gdb: '$line'";
 
-      my $bt = "";
-      while ($sz > 0) {
-         read (LOG, $data, 4);
-         my ($ra) = unpack 'I', $data;
-         $sz = $sz - 4;
-         $bt = $bt . sprintf ("%x;", $ra);
-      }
-      $bt =~ s/;$//;
+            my $method = '';
+            my $file   = '';
+            my $num    = '';
 
-      if ($log != 0) {
-         $chunks{$ptr}{'backtrace'} = $bt;
-         $chunks{$ptr}{'size'} = $size;
-         $chunks{$ptr}{'thread_id'} = $thread_id;
-         $chunks{$ptr}{'timestamp'} = $ts;
+            # No debugging information but the symbol could be resolved
+            if ($line =~ /No line number information available for address 0x[0-9a-f]+ <([A-Za-z0-9_:, ()<>&*]+)\+\d+>/) {
+               $method = $1;
+               debug "matched to symbol $method";
+            }
+            # File & line information found
+            elsif ($line =~ /Line (\d+) of "([^"]+)" starts at address 0x[0-9a-f]+ <([A-Za-z0-9_:, ()<>&*]+)\+\d+>/) {
+               $num    = $1;
+               $file   = $2;
+               $method = $3;
+               debug "matched to $file:$line ($method)";
+            }
+            elsif ($line =~ /A problem internal to GDB has been detected,/) {
+               $line = <RP>; # skip "further debugging may prove unreliable."
+               $line = <RP>; # skip "Quit this debugging session? (y or n)..."
+               $line = <RP>;
+               $line =~ s/\n//g;
+            }
 
-         if (!defined ($hotspots{$bt}{'size'})) {
-            $hotspots{$bt}{'allocs'} = 0;
-            $hotspots{$bt}{'frees'}  = 0;
-            $hotspots{$bt}{'size'}   = 0;
+            add_symbol ($a, $obj, $method, $file, $num);
          }
-         $hotspots{$bt}{'allocs'} = $hotspots{$bt}{'allocs'} + 1;
-         $hotspots{$bt}{'size'}   = $hotspots{$bt}{'size'} + $size;
 
-         $total = $total + $size;
-         $allocs ++;
+         # unload symbol file(s)
+         print WP "symbol-file\n";
+      }
+      # File could not be loaded
+      else {
+         add_unknown_symbols ($obj);
       }
    }
+   print WP "quit\n";
+   close (RP);
+   close (WP);
+}
 
-   # FREE event
-   if ($ev == $EV_FREE) {
-
-      read (LOG, $data, 4);
-      my ($ptr) = unpack 'I', $data;
-      $sz = $sz - 4;
+#----------------------------------------------------------------------------
+# Symbol cache
+#----------------------------------------------------------------------------
 
-      debug "LOG FREE ptr=$ptr";
+# Entries loaded from the symbol cache, per key
+my %symbol_cache_entries;
 
-      my $bt = "";
-      while ($sz > 0) {
-         read (LOG, $data, 4);
-         my ($ra) = unpack 'I', $data;
-         $sz = $sz - 4;
-         $bt = $bt . sprintf ("%x;", $ra);
-      }
-      $bt =~ s/;$//;
+# Entries decoded during this run (and object they were found in), per
+# key, to be added to the cache on exit
+my %symbol_cache_added;
+my %symbol_cache_names;
 
-      if ($log != 0) {
-         if (defined $chunks{$ptr}) {
-            my $size = $chunks{$ptr}{'size'};
-            $total = $total - $size;
+# Get the key under which symbols of an object are cached: its build-id
+# or a hash of its contents for binaries built without one
+sub symbol_cache_key {
+   my $obj = $_[0];
+   my $file = $objects{$obj}{'file'};
 
-            my $bt = $chunks{$ptr}{'backtrace'};
-            $hotspots{$bt}{'frees'} = $hotspots{$bt}{'frees'} + 1;
-            $hotspots{$bt}{'size'}  = $hotspots{$bt}{'size'} - $size;
-         }
-         else {
-            my $count = 1;
-            if (defined $unknown_frees{$bt}) {
-               $count = $count + $unknown_frees{$bt} 
-            }
-            $unknown_frees{$bt} = $count;
-         }
+   object_elf ($obj);
+   my $key = $objects{$obj}{'build_id'};
 
-         $frees ++;
-         delete $chunks{$ptr};
+   if ($key eq '') {
+      if (open (BIN, '<', $file)) {
+         binmode (BIN);
+         $key = 'md5-' . Digest::MD5->new->addfile (*BIN)->hexdigest;
+         close (BIN);
       }
    }
+   return $key;
+}
 
-   # REALLOC event
-   if ($ev == $EV_REALLOC) {
-
-      read (LOG, $data, 12);
-      my ($oldptr, $size, $newptr) = unpack 'III', $data;
-      $sz = $sz - 4 - 4 - 4;
+# Offset of an address from the start of the object it belongs to
+sub object_offset {
+   my ($obj, $a) = @_;
+   return hex ($a) - $objects{$obj}{'start'} + $objects{$obj}{'pgoff'};
+}
 
-      debug "LOG REALLOC oldptr=$oldptr, $size=$size, newptr=$newptr";
+# Read the entries of a cache file
+sub symbol_cache_read {
+   my $key = $_[0];
+   my %entries;
 
-      my $bt = "";
-      while ($sz > 0) {
-         read (LOG, $data, 4);
-         my ($ra) = unpack 'I', $data;
-         $sz = $sz - 4;
-         $bt = $bt . sprintf ("%x;", $ra);
+   if (open (CACHE, '<', "$symbol_cache/$key")) {
+      foreach my $line (<CACHE>) {
+         next if ($line =~ /^#/);
+         $line =~ s/\n//;
+         my ($off, $method, $file, $num) = split (/\t/, $line, -1);
+         next if (!defined ($num));
+         $entries{$off} = [ $method, $file, $num ];
       }
-      $bt =~ s/;$//;
+      close (CACHE);
+   }
+   return \%entries;
+}
 
-      if ($log != 0) {
-         if (defined $chunks{$oldptr}) {
-            my $old_size = $chunks{$oldptr}{'size'};
-            my $old_bt   = $chunks{$oldptr}{'backtrace'};
-            $total = $total - $old_size;
-            $hotspots{$old_bt}{'size'} = $hotspots{$old_bt}{'size'} - $old_size;
-            $hotspots{$old_bt}{'frees'} = $hotspots{$old_bt}{'frees'} + 1;
-         }
+# Resolve addresses of an object from the cache, addresses that were
+# found are removed from the list of addresses to decode
+sub symbol_cache_lookup {
+   my $obj = $_[0];
+   my $key = symbol_cache_key ($obj);
 
-         $chunks{$newptr}{'backtrace'} = $bt;
-         $chunks{$newptr}{'size'} = $size;
-         $chunks{$newptr}{'thread_id'} = $thread_id;
-         $chunks{$newptr}{'timestamp'} = $ts;
+   return if ($key eq '');
+   $objects{$obj}{'cache_key'} = $key;
 
-         if (!defined ($hotspots{$bt}{'size'})) {
-            $hotspots{$bt}{'allocs'} = 0;
-            $hotspots{$bt}{'frees'}  = 0;
-            $hotspots{$bt}{'size'}   = 0;
-         }
-         $hotspots{$bt}{'allocs'} = $hotspots{$bt}{'allocs'} + 1;
-         $hotspots{$bt}{'size'}   = $hotspots{$bt}{'size'} + $size;
+   if (!defined ($symbol_cache_entries{$key})) {
+      $symbol_cache_entries{$key} = symbol_cache_read ($key);
+   }
 
-         $total = $total + $size;
-         $reallocs ++;
+   my $entries = $symbol_cache_entries{$key};
+   my $hits = 0;
+   foreach my $a (keys %{ $objects{$obj}{'addrs'} }) {
+      my $off = sprintf ("%x", object_offset ($obj, $a));
+      if (defined ($entries->{$off})) {
+         add_symbol ($a, $obj, @{ $entries->{$off} });
+         delete $objects{$obj}{'addrs'}{$a};
+         $hits ++;
       }
    }
-
-   if ($total > $heap_max) {
-      $heap_max = $total;
+   debug "symbol cache: $hits hit(s) for $obj ($key)";
+   if (scalar (keys %{ $objects{$obj}{'addrs'} }) == 0) {
+      delete $objects{$obj}{'addrs'};
    }
-
-   $heap_history[$lines]{'timestamp'} = $ts;
-   $heap_history[$lines]{'heap'} = $total;
 }
-close(LOG);
 
-print "\n";
-print "Summary:\n";
-print "--------\n";
-print "\n";
+# Remember addresses decoded for objects found in the cache
+sub symbol_cache_update {
+   foreach my $obj (keys %objects) {
+      my $key = $objects{$obj}{'cache_key'};
+      next if ((!defined ($key)) || (!defined ($objects{$obj}{'addrs'})));
 
-print $total . " bytes (" . keys(%chunks) . " blocks) in use\n";
-print $allocs . " allocs, " . $frees . " frees, " . $reallocs . " reallocs\n";
-if (scalar (keys %unknown_frees) > 0) {
-   print "Note: " . scalar(keys %unknown_frees) . " frees for unknown blocks!\n";
+      foreach my $a (keys %{ $objects{$obj}{'addrs'} }) {
+         next if (!defined ($hsyms{$a}));
+         my @fields = map { my $f = $_; $f =~ s/[\t\n]/ /g; $f }
+            ($hsyms{$a}{'method'}, $hsyms{$a}{'path'}, $hsyms{$a}{'line'});
+         my $off = sprintf ("%x", object_offset ($obj, $a));
+         $symbol_cache_entries{$key}{$off} = \@fields;
+         $symbol_cache_added{$key}{$off} = \@fields;
+         $symbol_cache_names{$key} = basename ($obj);
+      }
+   }
 }
-print "$logs_lost log entries lost!\n";
-print "\n";
 
-my $time_total = $ts_max - $ts_min;
-my $time_incr = $time_total / $graph_cols;
-my $heap_incr = $heap_max / $graph_rows;
+# Add the addresses decoded during this run to the cache. Writers of a
+# cache file are serialized with a lock and merge their entries with
+# those found in the file at that time, the file is then replaced
+# atomically so that several runs and analysts may share the same cache.
+sub symbol_cache_store {
+   foreach my $key (sort keys %symbol_cache_added) {
+      my $name = "$symbol_cache/$key";
 
-my @graph;
-my $x;
-my $y;
+      open (LOCK, '>>', "$name.lock") or next;
+      flock (LOCK, LOCK_EX);
 
-my ($y_label, $y_unit) = B_max_label ($heap_max);
-my ($x_label, $x_unit) = t_max_label ($ts_max - $ts_min);
+      my $entries = symbol_cache_read ($key);
+      my $added = $symbol_cache_added{$key};
+      foreach my $off (keys %{ $added }) {
+         $entries->{$off} = $added->{$off};
+      }
 
-# Initialize (erase) graph
-for ($x = 1; $x <= $graph_cols; $x++) {
-   for ($y = 1; $y <= $graph_rows; $y++) {
-      $graph[$x][$y] = ' ';
+      my ($tmp, $tmpname) = tempfile ("$key.XXXXXX", DIR => $symbol_cache);
+      print $tmp "# memtraq symbol cache for " . $symbol_cache_names{$key} . "\n";
+      foreach my $off (sort keys %{ $entries }) {
+         print $tmp join ("\t", $off, @{ $entries->{$off} }) . "\n";
+      }
+      close ($tmp);
+      # Temporary files are only readable by their owner
+      chmod (0666 & ~umask (), $tmpname);
+      if (!rename ($tmpname, $name)) {
+         unlink ($tmpname);
+      }
+      close (LOCK);
    }
+   %symbol_cache_added = ();
 }
 
-# Fill heap history graph
-my $samples = scalar (@heap_history);
-for (my $i = 1; $i < $samples; $i ++) {
-   my $ts = $heap_history[$i]{'timestamp'};
-   my $heap = $heap_history[$i]{'heap'};
-   $ts = $ts - $ts_min;
-   $x = $ts / $time_incr;
-   $y = $heap / $heap_incr;
-   for (my $j = 1; $j <= $y; $j ++) {
-      $graph[$x][$j] = ':';
+# Find the file of an object and its load offset. Addresses found in
+# the symbol cache are decoded on the way.
+sub locate_object {
+   my $obj = $_[0];
+
+   # Objects are only looked up once
+   if (!defined ($objects{$obj}{'file'})) {
+      my $file = $obj;
+      my @paths_array = split (/:/, $paths);
+      $objects{$obj}{'file'} = '';
+      foreach my $p (@paths_array) {
+         if (-e $p . $obj) {
+            $file = $p . $obj;
+         }
+         elsif (-e $p . "/" . basename ($obj)) {
+            $file = $p . "/" . basename ($obj);
+         }
+      }
+      debug "Checking for $file...";
+      if (-e $file) {
+         $objects{$obj}{'file'} = $file;
+      }
+   }
+
+   my $file = $objects{$obj}{'file'};
+   return if ($file eq '');
+
+   if ($symbol_cache ne '') {
+      symbol_cache_lookup ($obj);
+      # All addresses found in the cache
+      return if (!defined ($objects{$obj}{'addrs'}));
+   }
+
+   if ($symbolizer eq 'addr2line') {
+      object_elf ($obj);
+   }
+   elsif (!defined ($objects{$obj}{'offset'})) {
+      my $type = `file -L -b $file`;
+      if ($type =~ / executable,/) {
+         $objects{$obj}{'offset'} = 0;
+      }
+      else {
+         my $offset = `$objdump -h $file |grep ' .text '|awk '{ print \$4; }'`;
+         $offset =~ s/\n//g;
+         $objects{$obj}{'offset'} = hex ($offset);
+      }
    }
 }
-undef @heap_history;
 
-# Print X and Y axis
-$graph[0][0] = '+';                                            # axes join point
-for ($x = 1; $x <= $graph_cols; $x++) { $graph[$x][0] = '-'; } # X-axis
-for ($y = 1; $y <= $graph_rows; $y++) { $graph[0][$y] = '|'; } # Y-axis
-$graph[$graph_cols][0] = '>';                                  # X-axis arrow
-$graph[0][$graph_rows] = '^';                                  # Y-axis arrow 
+# Decode all the addresses of the provided objects
+sub symbolize_objects {
+   if ($symbolizer eq 'addr2line') {
+      foreach my $obj (@_) {
+         if (($objects{$obj}{'file'} eq '') || (!symbolize_addr2line ($obj))) {
+            add_unknown_symbols ($obj);
+         }
+      }
+   }
+   elsif (scalar (@_) > 0) {
+      symbolize_gdb (@_);
+   }
+}
 
-printf("    %2s\n", $y_unit);
-for ($y = $graph_rows; $y >= 0; $y--) {
-   if ($graph_rows == $y) {          # top row
-      print($y_label);
-    } elsif (0 == $y) {              # bottom row
-       print("   0 ");
-    } else {                         # anywhere else
-        print("     ");
-    }
+# Spread objects to decode over --jobs worker processes. Objects are
+# assigned largest first to the least loaded worker; each worker writes
+# its results to a file that gets merged into 'hsyms' once it is done.
+sub symbolize_objects_parallel {
+   my @objs = sort { scalar (keys %{ $objects{$b}{'addrs'} })
+                 <=> scalar (keys %{ $objects{$a}{'addrs'} }) } @_;
+   my $n = ($jobs < scalar (@objs)) ? $jobs : scalar (@objs);
 
-    # Axis and data for the row.
-    for ($x = 0; $x <= $graph_cols; $x++) {
-       printf("%s", $graph[$x][$y]);
-    }
-    if (0 == $y) {
-       print("$x_unit\n");
-    } else {
-       print("\n");
-    }
+   if ($n <= 1) {
+      symbolize_objects (@objs);
+      return;
+   }
+
+   my @subsets;
+   my @load = (0) x $n;
+   foreach my $obj (@objs) {
+      my $w = 0;
+      for (my $i = 1; $i < $n; $i++) {
+         $w = $i if ($load[$i] < $load[$w]);
+      }
+      push (@{ $subsets[$w] }, $obj);
+      $load[$w] += scalar (keys %{ $objects{$obj}{'addrs'} });
+   }
+
+   my %workers;
+   STDOUT->flush ();
+   STDERR->flush ();
+   for (my $i = 0; $i < $n; $i++) {
+      my ($tmp, $tmpname) = tempfile (UNLINK => 1);
+      close ($tmp);
+      my $pid = fork ();
+      die("Could not fork symbolizer worker!") if (!defined ($pid));
+      if ($pid == 0) {
+         my @subset = @{ $subsets[$i] };
+         symbolize_objects (@subset);
+         open (OUT, '>', $tmpname) or POSIX::_exit (1);
+         foreach my $obj (@subset) {
+            foreach my $a (keys %{ $objects{$obj}{'addrs'} }) {
+               next if (!defined ($hsyms{$a}));
+               my @fields = map { my $f = $_; $f =~ s/[\t\n]/ /g; $f }
+                  ($a, $obj, $hsyms{$a}{'method'}, $hsyms{$a}{'path'}, $hsyms{$a}{'line'});
+               print OUT join ("\t", @fields) . "\n";
+            }
+         }
+         close (OUT);
+         # leave without running destructors of the parent's state
+         POSIX::_exit (0);
+      }
+      debug "symbolizer worker $pid: " . scalar (@{ $subsets[$i] }) . " object(s), $load[$i] address(es)";
+      $workers{$pid} = $tmpname;
+   }
+
+   while ((my $pid = wait ()) > 0) {
+      my $tmpname = $workers{$pid};
+      next if (!defined ($tmpname));
+      debug "symbolizer worker $pid exited with status $?";
+      if (open (IN, '<', $tmpname)) {
+         foreach my $line (<IN>) {
+            $line =~ s/\n//;
+            my ($a, $obj, $method, $file, $num) = split (/\t/, $line, -1);
+            add_symbol ($a, $obj, $method, $file, $num);
+         }
+         close (IN);
+      }
+      unlink ($tmpname);
+   }
+
+   # Addresses a failed worker did not report
+   foreach my $obj (@objs) {
+      foreach my $a (keys %{ $objects{$obj}{'addrs'} }) {
+         add_symbol ($a, $obj, '', '', '') if (!defined ($hsyms{$a}));
+      }
+   }
+}
+
+# Queue the addresses of a callstack for decoding
+sub collect_addresses {
+   my @bt = split (/\;/, $_[0]);
+
+   foreach my $a (@bt) {
+      next if (defined ($hsyms{$a}));
+      my $obj = object_from_addr ($a);
+      if ($obj ne "unknown") {
+         $objects{$obj}{'addrs'}{$a} = 1;
+      }
+   }
+}
+
+# Decode all the addresses queued with collect_addresses(), with --jobs
+# workers or in this process if asked to (live reports only decode the
+# few callsites they show)
+sub decode_pending {
+   my $in_process = $_[0] || 0;
+
+   foreach my $obj (keys %objects) {
+      next if (!defined ($objects{$obj}{'addrs'}));
+      locate_object ($obj);
+   }
+
+   my @objs = grep { defined ($objects{$_}{'addrs'}) } keys %objects;
+   if ($in_process) {
+      symbolize_objects (@objs);
+   }
+   else {
+      symbolize_objects_parallel (@objs);
+   }
+
+   if ($symbol_cache ne '') {
+      symbol_cache_update ();
+   }
+
+   foreach my $obj (keys %objects) {
+      delete $objects{$obj}{'addrs'};
+   }
 }
-printf("     0%s%5s\n", ' ' x ($graph_cols-5), $x_label);
-undef @graph;
 
 #----------------------------------------------------------------------------
-# Decode all addresses
+# Allocator simulation (--simulate)
 #----------------------------------------------------------------------------
 
-print "\n";
+# Blocks are replayed through simple models of common allocators to estimate
+# the memory they would hold. Each model tracks the bytes requested by live
+# blocks, the bytes of the chunks or slots handed out for them (allocated)
+# and the bytes obtained from the system (footprint). Internal fragmentation
+# is allocated - requested, external fragmentation footprint - allocated.
 
-# First pass, get all the addresses we need to decode per object
-# Effectively building a hash of hashes where the 1st level are
-# the objects and the 2nd level the addresses from that object.
-# Also check memory usage on a per object and on a per thread
-# basis.
-foreach my $ptr (keys %chunks) {
-   my $btstr = $chunks{$ptr}{'backtrace'};
-   my $thread_id = $chunks{$ptr}{'thread_id'};
-   my @bt = split (/\;/, $btstr);
-   if (defined $bt[1]) {
-      my $obj = object_from_addr ($bt[1]);
-      if (defined ($obj)) {
-         if (defined ($usage_by_objects{$obj})) {
-            $usage_by_objects{$obj} += $chunks{$ptr}{'size'};
+my $SIM_PAGE = 4096;
+
+# glibc-like: 32-bit chunks (4 bytes of overhead, 8-byte alignment, 16 bytes
+# minimum), best fit among free chunks coalesced with their neighbours (the
+# smallest chunk large enough, the lowest address among equal sizes), a top
+# chunk trimmed when 128KB are free at its end and requests of 128KB or more
+# served by mmap()
+my $SIM_GLIBC_MMAP = 128 * 1024;
+my $SIM_GLIBC_TRIM = 128 * 1024;
+
+# size-class slab: small sizes rounded up to one of a set of classes and
+# served from slabs of same-size slots, slabs being released when empty.
+# Larger requests get page-rounded spans of their own
+my $SIM_SLAB_MAX = 16 * 1024;
+my @sim_slab_classes;
+my @sim_slab_lookup;
+
+my @sim_models;
+
+sub sim_new {
+   my ($name, $title) = @_;
+
+   return {
+      'name'      => $name,
+      'title'     => $title,
+      'blocks'    => {},
+      'requested' => 0,
+      'allocated' => 0,
+      'footprint' => 0,
+      'peak'      => { 'footprint' => 0, 'allocated' => 0, 'requested' => 0, 'ts' => 0 },
+      'history'   => [],
+      'updates'   => 0,
+   };
+}
+
+sub sim_round {
+   my ($size, $align) = @_;
+   return int (($size + $align - 1) / $align) * $align;
+}
+
+# Index of the first element of a sorted array greater than or equal to a
+# value (the size of the array if none). Free lists are kept sorted so that
+# the models choose chunks and slabs the same way from one run to another
+# (mappings are kept sorted by start address too)
+sub sorted_find {
+   my ($array, $value) = @_;
+   my ($lo, $hi) = (0, scalar (@{ $array }));
+
+   while ($lo < $hi) {
+      my $mid = ($lo + $hi) >> 1;
+      if ($array->[$mid] < $value) {
+         $lo = $mid + 1;
+      }
+      else {
+         $hi = $mid;
+      }
+   }
+   return $lo;
+}
+
+sub sorted_insert {
+   my ($array, $value) = @_;
+   my $i = sorted_find ($array, $value);
+
+   splice (@{ $array }, $i, 0, $value) if (($i == scalar (@{ $array })) || ($array->[$i] != $value));
+}
+
+sub sorted_remove {
+   my ($array, $value) = @_;
+   my $i = sorted_find ($array, $value);
+
+   splice (@{ $array }, $i, 1) if (($i < scalar (@{ $array })) && ($array->[$i] == $value));
+}
+
+# glibc-like model
+
+sub sim_glibc_init {
+   my $m = sim_new ('glibc', 'glibc-like');
+
+   $m->{'top'} = 0;
+   $m->{'brk'} = 0;
+   $m->{'free_start'} = {};
+   $m->{'free_end'} = {};
+   $m->{'bins'} = {};
+   $m->{'sizes'} = [];
+   $m->{'alloc'} = \&sim_glibc_alloc;
+   $m->{'free'} = \&sim_glibc_free;
+   $m->{'realloc'} = \&sim_glibc_realloc;
+   return $m;
+}
+
+sub sim_glibc_add_free {
+   my ($m, $start, $size) = @_;
+
+   $m->{'free_start'}{$start} = $size;
+   $m->{'free_end'}{$start + $size} = $start;
+   if (!defined ($m->{'bins'}{$size})) {
+      $m->{'bins'}{$size} = [];
+      sorted_insert ($m->{'sizes'}, $size);
+   }
+   sorted_insert ($m->{'bins'}{$size}, $start);
+}
+
+sub sim_glibc_remove_free {
+   my ($m, $start) = @_;
+   my $size = delete $m->{'free_start'}{$start};
+
+   delete $m->{'free_end'}{$start + $size};
+   sorted_remove ($m->{'bins'}{$size}, $start);
+   if (!@{ $m->{'bins'}{$size} }) {
+      delete $m->{'bins'}{$size};
+      sorted_remove ($m->{'sizes'}, $size);
+   }
+   return $size;
+}
+
+# Release a chunk, merging it with free neighbours and the top chunk
+sub sim_glibc_release {
+   my ($m, $start, $size) = @_;
+
+   my $prev = $m->{'free_end'}{$start};
+   if (defined ($prev)) {
+      $size += sim_glibc_remove_free ($m, $prev);
+      $start = $prev;
+   }
+   if (defined ($m->{'free_start'}{$start + $size})) {
+      $size += sim_glibc_remove_free ($m, $start + $size);
+   }
+   if ($start + $size == $m->{'top'}) {
+      $m->{'top'} = $start;
+      if ($m->{'brk'} - $m->{'top'} >= $SIM_GLIBC_TRIM) {
+         $m->{'brk'} = sim_round ($m->{'top'}, $SIM_PAGE);
+      }
+   }
+   else {
+      sim_glibc_add_free ($m, $start, $size);
+   }
+}
+
+# Find the best free chunk for the given size: the smallest one large enough
+# and the lowest one among those of that size
+sub sim_glibc_find {
+   my ($m, $csize) = @_;
+   my $sizes = $m->{'sizes'};
+   my $i = sorted_find ($sizes, $csize);
+
+   return undef if ($i == scalar (@{ $sizes }));
+   return $m->{'bins'}{$sizes->[$i]}[0];
+}
+
+# Split the end of a chunk off if large enough to be a chunk of its own
+sub sim_glibc_split {
+   my ($m, $start, $size, $csize) = @_;
+
+   if ($size - $csize >= 16) {
+      sim_glibc_release ($m, $start + $csize, $size - $csize);
+      return $csize;
+   }
+   return $size;
+}
+
+sub sim_glibc_chunk_size {
+   my $size = ($_[0] + 4 + 7) & ~7;
+   return ($size < 16) ? 16 : $size;
+}
+
+sub sim_glibc_alloc {
+   my ($m, $id, $req) = @_;
+   my $csize = sim_glibc_chunk_size ($req);
+   my $start;
+
+   if ($csize >= $SIM_GLIBC_MMAP) {
+      my $mapped = sim_round ($req + 8, $SIM_PAGE);
+      $m->{'footprint'} += $mapped;
+      $m->{'blocks'}{$id} = [ -1, $mapped, $req ];
+      return $mapped;
+   }
+
+   $start = sim_glibc_find ($m, $csize);
+   if (defined ($start)) {
+      my $size = sim_glibc_remove_free ($m, $start);
+      $csize = sim_glibc_split ($m, $start, $size, $csize);
+   }
+   else {
+      $start = $m->{'top'};
+      $m->{'top'} += $csize;
+      if ($m->{'top'} > $m->{'brk'}) {
+         $m->{'brk'} = sim_round ($m->{'top'}, $SIM_PAGE);
+      }
+   }
+   $m->{'blocks'}{$id} = [ $start, $csize, $req ];
+   return $csize;
+}
+
+sub sim_glibc_free {
+   my ($m, $id) = @_;
+   my $b = delete $m->{'blocks'}{$id};
+
+   if ($b->[0] < 0) {
+      $m->{'footprint'} -= $b->[1];
+   }
+   else {
+      sim_glibc_release ($m, $b->[0], $b->[1]);
+   }
+   return $b;
+}
+
+# Resize in place when shrinking or when the next chunk (or the top chunk)
+# has room, move the block otherwise
+sub sim_glibc_realloc {
+   my ($m, $oldid, $newid, $req) = @_;
+   my $b = $m->{'blocks'}{$oldid};
+   my $csize = sim_glibc_chunk_size ($req);
+
+   if (($b->[0] >= 0) && ($csize < $SIM_GLIBC_MMAP)) {
+      my ($start, $size) = @{ $b };
+      my $next = $start + $size;
+
+      if ($csize > $size) {
+         if ($next == $m->{'top'}) {
+            $m->{'top'} = $start + $csize;
+            if ($m->{'top'} > $m->{'brk'}) {
+               $m->{'brk'} = sim_round ($m->{'top'}, $SIM_PAGE);
+            }
+            $size = $csize;
          }
-         else {
-            $usage_by_objects{$obj} = $chunks{$ptr}{'size'};
+         elsif ((defined ($m->{'free_start'}{$next})) &&
+                ($size + $m->{'free_start'}{$next} >= $csize)) {
+            $size += sim_glibc_remove_free ($m, $next);
          }
       }
-      if (defined ($usage_by_threads{$thread_id})) {
-         $usage_by_threads{$thread_id} += $chunks{$ptr}{'size'};
+      if ($csize <= $size) {
+         $size = sim_glibc_split ($m, $start, $size, $csize);
+         delete $m->{'blocks'}{$oldid};
+         $m->{'blocks'}{$newid} = [ $start, $size, $req ];
+         return ($b->[1], $size);
+      }
+   }
+
+   my $allocated = sim_glibc_alloc ($m, 'realloc', $req);
+   sim_glibc_free ($m, $oldid);
+   $m->{'blocks'}{$newid} = delete $m->{'blocks'}{'realloc'};
+   return ($b->[1], $allocated);
+}
+
+# size-class slab model
+
+sub sim_slab_init {
+   my $m = sim_new ('slab', 'size-class slab');
+
+   # 8, 16 to 128 by steps of 16 and then 4 classes per doubling
+   if (scalar (@sim_slab_classes) == 0) {
+      push (@sim_slab_classes, 8);
+      for (my $size = 16; $size <= 128; $size += 16) {
+         push (@sim_slab_classes, $size);
+      }
+      for (my $base = 128; $base < $SIM_SLAB_MAX; $base *= 2) {
+         for (my $i = 1; $i <= 4; $i ++) {
+            push (@sim_slab_classes, $base + ($i * $base / 4));
+         }
+      }
+      my $ci = 0;
+      for (my $i = 0; $i <= $SIM_SLAB_MAX / 8; $i ++) {
+         $ci ++ while ($sim_slab_classes[$ci] < $i * 8);
+         $sim_slab_lookup[$i] = $ci;
+      }
+   }
+
+   $m->{'slabs'} = {};
+   $m->{'nonfull'} = {};
+   $m->{'current'} = {};
+   $m->{'next_slab'} = 0;
+   $m->{'alloc'} = \&sim_slab_alloc;
+   $m->{'free'} = \&sim_slab_free;
+   $m->{'realloc'} = \&sim_slab_realloc;
+   return $m;
+}
+
+# Slabs hold at least 8 slots and are made of whole pages
+sub sim_slab_size {
+   return sim_round ($_[0] * 8, $SIM_PAGE);
+}
+
+sub sim_slab_alloc {
+   my ($m, $id, $req) = @_;
+
+   if ($req > $SIM_SLAB_MAX) {
+      my $span = sim_round ($req, $SIM_PAGE);
+      $m->{'footprint'} += $span;
+      $m->{'blocks'}{$id} = [ -1, $span, $req ];
+      return $span;
+   }
+
+   my $ci = $sim_slab_lookup[($req + 7) >> 3];
+   my $class = $sim_slab_classes[$ci];
+   my $slots = int (sim_slab_size ($class) / $class);
+   my $slab = $m->{'current'}{$ci};
+
+   if (!defined ($slab)) {
+      # Refill the lowest non-full slab of the class first
+      my $nonfull = $m->{'nonfull'}{$ci};
+      if ((defined ($nonfull)) && (@{ $nonfull })) {
+         $slab = shift (@{ $nonfull });
       }
       else {
-         $usage_by_threads{$thread_id} = $chunks{$ptr}{'size'};
+         $slab = $m->{'next_slab'} ++;
+         $m->{'slabs'}{$slab} = 0;
+         $m->{'footprint'} += sim_slab_size ($class);
+      }
+      $m->{'current'}{$ci} = $slab;
+   }
+   if (++ $m->{'slabs'}{$slab} == $slots) {
+      delete $m->{'current'}{$ci};
+   }
+   $m->{'blocks'}{$id} = [ $ci, $class, $req, $slab ];
+   return $class;
+}
+
+sub sim_slab_free {
+   my ($m, $id) = @_;
+   my $b = delete $m->{'blocks'}{$id};
+   my ($ci, $class, $req, $slab) = @{ $b };
+
+   if ($ci < 0) {
+      $m->{'footprint'} -= $class;
+      return $b;
+   }
+
+   my $current = $m->{'current'}{$ci};
+   if (-- $m->{'slabs'}{$slab} == 0) {
+      delete $m->{'slabs'}{$slab};
+      sorted_remove ($m->{'nonfull'}{$ci}, $slab) if (defined ($m->{'nonfull'}{$ci}));
+      delete $m->{'current'}{$ci} if ((defined ($current)) && ($current == $slab));
+      $m->{'footprint'} -= sim_slab_size ($class);
+   }
+   elsif ((!defined ($current)) || ($current != $slab)) {
+      $m->{'nonfull'}{$ci} = [] if (!defined ($m->{'nonfull'}{$ci}));
+      sorted_insert ($m->{'nonfull'}{$ci}, $slab);
+   }
+   return $b;
+}
+
+# Resize in place when staying in the same size class
+sub sim_slab_realloc {
+   my ($m, $oldid, $newid, $req) = @_;
+   my $b = $m->{'blocks'}{$oldid};
+
+   if (($b->[0] >= 0) && ($req <= $SIM_SLAB_MAX) &&
+       ($sim_slab_lookup[($req + 7) >> 3] == $b->[0])) {
+      delete $m->{'blocks'}{$oldid};
+      $m->{'blocks'}{$newid} = [ $b->[0], $b->[1], $req, $b->[3] ];
+      return ($b->[1], $b->[1]);
+   }
+
+   my $allocated = sim_slab_alloc ($m, 'realloc', $req);
+   sim_slab_free ($m, $oldid);
+   $m->{'blocks'}{$newid} = delete $m->{'blocks'}{'realloc'};
+   return ($b->[1], $allocated);
+}
+
+foreach my $name (split (/,/, $simulate)) {
+   if ($name eq 'glibc') {
+      push (@sim_models, sim_glibc_init ());
+   }
+   elsif ($name eq 'slab') {
+      push (@sim_models, sim_slab_init ());
+   }
+   else {
+      die("Unknown allocator model '" . $name . "' (use glibc or slab)!");
+   }
+}
+
+# Record the peak footprint of each model and sample it for the timeline
+sub sim_update {
+   my ($m, $ts) = @_;
+
+   # Footprint of the glibc-like heap is its (page-rounded) break
+   my $footprint = $m->{'footprint'} + ($m->{'brk'} || 0);
+   if ($footprint > $m->{'peak'}{'footprint'}) {
+      $m->{'peak'} = {
+         'footprint' => $footprint,
+         'allocated' => $m->{'allocated'},
+         'requested' => $m->{'requested'},
+         'ts'        => $ts,
+      };
+   }
+
+   # One sample (holding the highest footprint seen) per 1000 events
+   my $history = $m->{'history'};
+   if ((($m->{'updates'} ++) % 1000) == 0) {
+      push (@{ $history }, [ $ts, $footprint ]);
+   }
+   elsif ($footprint > $history->[-1][1]) {
+      $history->[-1][1] = $footprint;
+   }
+}
+
+sub sim_model_free {
+   my ($m, $ptr) = @_;
+   my $b = $m->{'free'}->($m, $ptr);
+
+   $m->{'allocated'} -= $b->[1];
+   $m->{'requested'} -= $b->[2];
+}
+
+sub sim_malloc {
+   my ($ptr, $size, $ts) = @_;
+
+   foreach my $m (@sim_models) {
+      # Free of the previous block at this address was not logged
+      sim_model_free ($m, $ptr) if (defined ($m->{'blocks'}{$ptr}));
+      $m->{'allocated'} += $m->{'alloc'}->($m, $ptr, $size);
+      $m->{'requested'} += $size;
+      sim_update ($m, $ts);
+   }
+}
+
+sub sim_free {
+   my ($ptr, $ts) = @_;
+
+   foreach my $m (@sim_models) {
+      next if (!defined ($m->{'blocks'}{$ptr}));
+      sim_model_free ($m, $ptr);
+      sim_update ($m, $ts);
+   }
+}
+
+sub sim_realloc {
+   my ($oldptr, $size, $newptr, $ts) = @_;
+
+   foreach my $m (@sim_models) {
+      my $b = $m->{'blocks'}{$oldptr};
+      if (!defined ($b)) {
+         next if ($newptr == 0);
+         $m->{'allocated'} += $m->{'alloc'}->($m, $newptr, $size);
+         $m->{'requested'} += $size;
+      }
+      elsif ($newptr == 0) {
+         sim_model_free ($m, $oldptr);
+      }
+      else {
+         my $old_req = $b->[2];
+         my ($old, $new) = $m->{'realloc'}->($m, $oldptr, $newptr, $size);
+         $m->{'allocated'} += $new - $old;
+         $m->{'requested'} += $size - $old_req;
+      }
+      sim_update ($m, $ts);
+   }
+}
+
+#----------------------------------------------------------------------------
+# Process log
+#----------------------------------------------------------------------------
+
+my %chunks;
+my $total = 0;
+my $allocs = 0;
+my $frees = 0;
+my %unknown_frees;
+my $reallocs = 0;
+my $callocs = 0;
+my $memaligns = 0;
+my $sized_frees = 0;
+my $log = 1;
+my %hotspots;
+my $lines = 0;
+my $current_serial = 0;
+my $logs_lost = 0;
+
+# Flags of the INIT event
+my $log_flags = 0;
+
+# Heap in use after each log entry, for the graph. With --follow and
+# --listen, the history is bounded: once it holds HEAP_HISTORY_MAX points,
+# pairs of consecutive points are merged into the one with the most heap in
+# use (the graph shows the highest point of each column) and each point
+# then stands for twice as many log entries.
+my @heap_history;
+my $HEAP_HISTORY_MAX = 16384;
+my $heap_history_stride = 1;
+my $heap_history_count = 0;
+
+# Keep the point with the most heap in use out of two
+sub heap_history_max {
+   my ($p, $q) = @_;
+   return ((defined ($q)) && ($q->{'heap'} > $p->{'heap'})) ? $q : $p;
+}
+
+sub heap_history_add {
+   my $point = { 'timestamp' => $_[0], 'heap' => $_[1] };
+
+   if ($heap_history_count == 0) {
+      push (@heap_history, $point);
+   }
+   else {
+      $heap_history[-1] = heap_history_max ($heap_history[-1], $point);
+   }
+   $heap_history_count = ($heap_history_count + 1) % $heap_history_stride;
+
+   if (($follow != 0) && ($heap_history_count == 0) &&
+       (scalar (@heap_history) >= $HEAP_HISTORY_MAX)) {
+      my @points;
+      for (my $i = 0; $i < scalar (@heap_history); $i += 2) {
+         push (@points, heap_history_max ($heap_history[$i], $heap_history[$i + 1]));
+      }
+      @heap_history = @points;
+      $heap_history_stride *= 2;
+   }
+}
+
+# Offset in the log of the entry being processed
+my $record_offset = 0;
+
+# Tags delimiting the --diff window ("A,B" or "A" for A to end of log)
+my ($diff_from_tag, $diff_to_tag) = split (/,/, $diff, 2);
+$diff_to_tag = '' if (!defined ($diff_to_tag));
+
+# Live bytes and blocks per callsite at both ends of the --diff window
+my %diff_from;
+my %diff_to;
+my $diff_state = 0;
+
+# Lifetime histograms of freed blocks per callsite (--lifetimes): counts
+# per power-of-two bucket of microseconds, bucket 0 for [0, 1us) and bucket
+# n for [2^(n-1), 2^n)
+my %lifetimes;
+
+# Requested sizes per callsite and across the process (--sizes), keyed by
+# size class
+my %sizes_by_callsite;
+my %sizes_total;
+
+# Live bytes per page of the address space and samples of the page usage
+# taken every 10000 log entries (--occupancy). Spans of contiguous pages and
+# sparse pages are counted as pages come and go, the lowest and highest pages
+# being looked up again when one of them is released
+my $PAGE_SHIFT = 12;
+my %page_live;
+my $page_spans = 0;
+my $page_sparse = 0;
+my ($page_min, $page_max);
+my @occupancy_history;
+
+# Durations (in nanoseconds) of the allocator calls per operation and per
+# callsite, as histograms (see %lifetimes) with their sum and maximum
+# (--latency)
+my %latency_ops;
+my %latency_sites;
+
+# Blocks freed by another thread than the one that allocated them, per
+# pair of threads ("allocating>freeing") and per callsite (--cross-thread).
+# Reallocs moving a block free it too and are counted apart, reallocs
+# keeping it in place are not counted.
+my %cross_pairs;
+my %cross_callsites;
+my $cross_frees = 0;
+my $cross_reallocs = 0;
+
+# Live blocks on the first and last cache line they span (the lines in
+# between belong to them only) and callsite pairs (newline-separated,
+# sorted) of blocks from different threads found on the same line
+# (--false-sharing)
+my %line_blocks;
+my %sharing_pairs;
+my $sharing_count = 0;
+
+# Buffers resized with realloc() by their current address and resize
+# statistics per callsite of their first realloc (--realloc-chains)
+my %chains;
+my %chain_sites;
+
+# Live memory mappings by start address (rounded to whole pages), bytes
+# they span ('anon' and 'file') and program break moves (--mappings)
+my %mappings;
+my @mapping_starts;
+my %mapped = ( 'anon' => 0, 'file' => 0 );
+my $mapped_anon_max = 0;
+my $mmaps = 0;
+my $munmaps = 0;
+my $brk_first;
+my $brk_current;
+my %brk_sites;
+
+# Labels of the contexts by identifier and, per label, the number of
+# contexts, bytes and blocks allocated and still live (--contexts)
+my %context_labels;
+my %context_stats;
+
+# Sized deletes whose size differs from the one of the block, per callsite
+# of the block
+my %sized_mismatches;
+
+# Live bytes per thread (blocks being accounted to the thread that
+# allocated them)
+my %thread_live;
+
+# Heap peaks: the global one (also saved in index checkpoints) and the one
+# of the --peak-window. The live set at the peak is the current one minus
+# the changes made since the peak, which are the only ones tracked
+my ($peak_from_tag, $peak_to_tag) = split (/,/, $peak_window, 2);
+$peak_to_tag = '' if (!defined ($peak_to_tag));
+my $peak_tracking = ($show_peak || $build_index || ($peak_window ne ''));
+my %peak = ( 'max' => 0, 'ts' => 0, 'serial' => 0, 'since' => {}, 'since_threads' => {},
+             'active' => ($show_peak || $build_index) );
+my %peak_in_window = ( 'max' => -1, 'ts' => 0, 'serial' => 0, 'since' => {}, 'since_threads' => {}, 'active' => 0 );
+my %peak_window_snapshot;
+
+# Trace ids of the large blocks (--trace)
+my %trace_blocks;
+my $trace_id = 0;
+my $trace_first = 1;
+
+# Live bytes per callsite sampled at the end of each --trend-window
+my @trend_samples;
+my $trend_next;
+
+# Tags and checkpoints found while building the index
+my @index_tags;
+my @index_checkpoints;
+
+# Log time of the next checkpoint (--checkpoint-seconds)
+my $checkpoint_next_ts = 0;
+
+if ($after ne '') {
+   print "# tracking on hold till tag '" . $after . "' (--after)...\n";
+   $log = 0;
+}
+
+# Get live bytes and blocks for all callsites with live blocks
+sub callsite_snapshot {
+   my %result;
+
+   foreach my $btstr (keys %hotspots) {
+      next if ($hotspots{$btstr}{'size'} == 0);
+      $result{$btstr}{'bytes'}  = $hotspots{$btstr}{'size'};
+      $result{$btstr}{'blocks'} = $hotspots{$btstr}{'allocs'} - $hotspots{$btstr}{'frees'};
+   }
+   return %result;
+}
+
+# Add a lifetime to a histogram (see %lifetimes)
+sub lifetime_add {
+   my ($l, $lifetime) = @_;
+   my $bucket = 0;
+
+   $bucket ++ while (($lifetime >> $bucket) > 0);
+   $l->{'buckets'}[$bucket] ++;
+   $l->{'count'} ++;
+}
+
+sub record_lifetime {
+   my ($btstr, $lifetime) = @_;
+
+   lifetime_add (\%{ $lifetimes{$btstr} }, $lifetime);
+   $lifetimes{$btstr}{'short'} ++ if ($lifetime < $short_lived);
+}
+
+sub record_latency {
+   my ($op, $btstr, $duration) = @_;
+
+   foreach my $l (\%{ $latency_ops{$op} }, \%{ $latency_sites{$btstr} }) {
+      lifetime_add ($l, $duration);
+      $l->{'sum'} += $duration;
+      $l->{'max'} = $duration if ($duration > ($l->{'max'} || 0));
+   }
+}
+
+# Record the free of a block by another thread than its allocating one,
+# with free() or with a realloc moving it
+sub record_cross_free {
+   my ($ptr, $thread_id, $ts, $realloc) = @_;
+   my $c = $chunks{$ptr};
+
+   return if ($c->{'thread_id'} == $thread_id);
+   foreach my $e (\%{ $cross_pairs{$c->{'thread_id'} . ">" . $thread_id} },
+                  \%{ $cross_callsites{$c->{'backtrace'}} }) {
+      $e->{'bytes'} += $c->{'size'};
+      lifetime_add ($e, $ts - $c->{'timestamp'});
+   }
+   $cross_callsites{$c->{'backtrace'}}{'pairs'}{$c->{'thread_id'} . ">" . $thread_id} ++;
+   if ($realloc) {
+      $cross_callsites{$c->{'backtrace'}}{'reallocs'} ++;
+      $cross_reallocs ++;
+   }
+   else {
+      $cross_frees ++;
+   }
+}
+
+sub record_size {
+   my ($btstr, $size) = @_;
+   my $class = $size;
+
+   if ($size_classes eq 'pow2') {
+      $class = 1;
+      $class <<= 1 while ($class < $size);
+   }
+   $sizes_by_callsite{$btstr}{$class} ++;
+   $sizes_total{$class}{'count'} ++;
+   $sizes_total{$class}{'bytes'} += $size;
+}
+
+# Account the bytes of a block to the pages it spans, with sign 1 when it
+# is allocated and -1 when it is released (zero-size blocks count as 1 byte)
+sub page_account {
+   my ($ptr, $size, $sign) = @_;
+   my $end = $ptr + ($size || 1);
+
+   for (my $page = $ptr >> $PAGE_SHIFT; ($page << $PAGE_SHIFT) < $end; $page ++) {
+      my $from = $page << $PAGE_SHIFT;
+      my $to = $from + (1 << $PAGE_SHIFT);
+      $from = $ptr if ($from < $ptr);
+      $to = $end if ($to > $end);
+
+      my $before = $page_live{$page} || 0;
+      my $after = $before + $sign * ($to - $from);
+      $page_sparse -= 1 if (($before > 0) && ($before < $sparse_page));
+      $page_sparse += 1 if (($after > 0) && ($after < $sparse_page));
+      if ($after > 0) {
+         $page_live{$page} = $after;
+         next if ($before > 0);
+
+         # New page: joins, extends or starts a span
+         my $neighbours = (exists ($page_live{$page - 1}) ? 1 : 0) + (exists ($page_live{$page + 1}) ? 1 : 0);
+         $page_spans += 1 - $neighbours;
+         $page_min = $page if ((defined ($page_min)) && ($page < $page_min));
+         $page_max = $page if ((defined ($page_max)) && ($page > $page_max));
+         ($page_min, $page_max) = ($page, $page) if (scalar (keys %page_live) == 1);
+      }
+      elsif ($before > 0) {
+         delete $page_live{$page};
+
+         # Released page: splits, shortens or ends a span
+         my $neighbours = (exists ($page_live{$page - 1}) ? 1 : 0) + (exists ($page_live{$page + 1}) ? 1 : 0);
+         $page_spans += $neighbours - 1;
+         undef $page_min if ((defined ($page_min)) && ($page == $page_min));
+         undef $page_max if ((defined ($page_max)) && ($page == $page_max));
+      }
+   }
+}
+
+# Pages in use, contiguous spans of pages and the holes between them
+sub occupancy_sample {
+   my $pages = scalar (keys %page_live);
+   my $holes = 0;
+
+   if ($pages > 0) {
+      if ((!defined ($page_min)) || (!defined ($page_max))) {
+         ($page_min, $page_max) = (undef, undef);
+         foreach my $page (keys %page_live) {
+            $page_min = $page if ((!defined ($page_min)) || ($page < $page_min));
+            $page_max = $page if ((!defined ($page_max)) || ($page > $page_max));
+         }
+      }
+      $holes = ($page_max - $page_min + 1) - $pages;
+   }
+   push (@occupancy_history, {
+      'ts'     => $_[0],
+      'live'   => $total,
+      'pages'  => $pages,
+      'spans'  => $page_spans,
+      'holes'  => $holes,
+      'sparse' => $page_sparse,
+   });
+}
+
+#
+# Trace events (--trace), see the Trace Event Format of Chrome's
+# about:tracing (also read by Perfetto)
+#
+
+sub trace_event {
+   print TRACE ($trace_first ? "\n" : ",\n") . $_[0];
+   $trace_first = 0;
+}
+
+sub trace_string {
+   my $s = $_[0];
+   $s =~ s/([\\"])/\\$1/g;
+   $s =~ s/([\x00-\x1f])/sprintf ("\\u%04x", ord ($1))/ge;
+   return '"' . $s . '"';
+}
+
+sub trace_heap {
+   my ($ts, $thread_id) = @_;
+
+   trace_event ("{\"name\":\"heap\",\"ph\":\"C\",\"ts\":$ts,\"pid\":1,\"args\":{\"bytes\":$total}}");
+   trace_event ("{\"name\":\"heap (thread $thread_id)\",\"ph\":\"C\",\"ts\":$ts,\"pid\":1," .
+                "\"args\":{\"bytes\":" . $thread_live{$thread_id} . "}}");
+}
+
+# Blocks are accounted to the thread that allocated them
+sub trace_alloc {
+   my ($ptr, $size, $thread_id, $ts) = @_;
+
+   if (($trace_large > 0) && ($size >= $trace_large)) {
+      $trace_blocks{$ptr} = ++ $trace_id;
+      trace_event ("{\"name\":\"$size bytes\",\"cat\":\"block\",\"ph\":\"b\",\"id\":$trace_id,\"ts\":$ts," .
+                   "\"pid\":1,\"tid\":$thread_id,\"args\":{\"ptr\":\"" . sprintf ("0x%x", $ptr) . "\"}}");
+   }
+   trace_heap ($ts, $thread_id);
+}
+
+sub trace_free {
+   my ($ptr, $ts) = @_;
+   my $thread_id = $chunks{$ptr}{'thread_id'};
+   my $size = $chunks{$ptr}{'size'};
+
+   my $id = delete $trace_blocks{$ptr};
+   if (defined ($id)) {
+      trace_event ("{\"name\":\"$size bytes\",\"cat\":\"block\",\"ph\":\"e\",\"id\":$id,\"ts\":$ts," .
+                   "\"pid\":1,\"tid\":$thread_id}");
+   }
+   trace_heap ($ts, $thread_id);
+}
+
+# Account live bytes and blocks added to (or removed from) a callsite
+sub live_change {
+   my ($btstr, $thread_id, $bytes, $blocks) = @_;
+
+   $thread_live{$thread_id} += $bytes;
+   return if (!$peak_tracking);
+   foreach my $p (\%peak, \%peak_in_window) {
+      next if (!$p->{'active'});
+      $p->{'since'}{$btstr}{'bytes'} += $bytes;
+      $p->{'since'}{$btstr}{'blocks'} += $blocks;
+      $p->{'since_threads'}{$thread_id} += $bytes;
+   }
+}
+
+# Check for a new peak after an event: changes made so far are then part
+# of the peak
+sub peak_check {
+   my ($ts, $serial) = @_;
+
+   return if (!$peak_tracking);
+   foreach my $p (\%peak, \%peak_in_window) {
+      next if ((!$p->{'active'}) || ($total <= $p->{'max'}));
+      $p->{'max'} = $total;
+      $p->{'ts'} = $ts;
+      $p->{'serial'} = $serial;
+      $p->{'since'} = {};
+      $p->{'since_threads'} = {};
+   }
+}
+
+# Live bytes and blocks per callsite and bytes per thread at a peak
+sub peak_snapshot {
+   my $p = $_[0];
+   my %callsites = callsite_snapshot ();
+   my %threads = %thread_live;
+
+   foreach my $btstr (keys %{ $p->{'since'} }) {
+      my $bytes = ($callsites{$btstr}{'bytes'} || 0) - $p->{'since'}{$btstr}{'bytes'};
+      my $blocks = ($callsites{$btstr}{'blocks'} || 0) - $p->{'since'}{$btstr}{'blocks'};
+      if ($bytes != 0) {
+         $callsites{$btstr} = { 'bytes' => $bytes, 'blocks' => $blocks };
+      }
+      else {
+         delete $callsites{$btstr};
+      }
+   }
+   foreach my $thread_id (keys %{ $p->{'since_threads'} }) {
+      $threads{$thread_id} -= $p->{'since_threads'}{$thread_id};
+   }
+   return {
+      'max'       => $p->{'max'},
+      'ts'        => $p->{'ts'},
+      'serial'    => $p->{'serial'},
+      'callsites' => \%callsites,
+      'threads'   => \%threads,
+   };
+}
+
+sub cache_lines {
+   my ($ptr, $size) = @_;
+   my $first = int ($ptr / $cache_line);
+   my $last = int (($ptr + ($size || 1) - 1) / $cache_line);
+
+   return ($first == $last) ? ($first) : ($first, $last);
+}
+
+# Check a new block against the live blocks of other threads sharing its
+# first or last cache line
+sub sharing_add {
+   my $ptr = $_[0];
+   my $c = $chunks{$ptr};
+
+   foreach my $line (cache_lines ($ptr, $c->{'size'})) {
+      foreach my $other (keys %{ $line_blocks{$line} }) {
+         my $o = $chunks{$other};
+         next if ($o->{'thread_id'} == $c->{'thread_id'});
+
+         my $key = join ("\n", sort ($c->{'backtrace'}, $o->{'backtrace'}));
+         my $threads = join (" & ", sort { $a <=> $b } ($c->{'thread_id'}, $o->{'thread_id'}));
+         $sharing_pairs{$key}{'count'} ++;
+         $sharing_pairs{$key}{'threads'}{$threads} ++;
+         $sharing_count ++;
+      }
+      $line_blocks{$line}{$ptr} = 1;
+   }
+}
+
+sub sharing_remove {
+   my $ptr = $_[0];
+
+   foreach my $line (cache_lines ($ptr, $chunks{$ptr}{'size'})) {
+      delete $line_blocks{$line}{$ptr};
+      delete $line_blocks{$line} if (!%{ $line_blocks{$line} });
+   }
+}
+
+# Follow a buffer through a realloc: bytes are copied when it moves
+sub chain_resize {
+   my ($oldptr, $old_size, $newptr, $size, $btstr) = @_;
+   my $chain = delete $chains{$oldptr};
+
+   if (!defined ($chain)) {
+      $chain = { 'site' => $btstr, 'resizes' => 0, 'first' => $old_size };
+   }
+   my $site = \%{ $chain_sites{$chain->{'site'}} };
+   $chain->{'resizes'} ++;
+   if ($newptr != $oldptr) {
+      my $copied = ($size < $old_size) ? $size : $old_size;
+      $site->{'moved'} ++;
+      $site->{'copied'} += $copied;
+   }
+   else {
+      $site->{'in_place'} ++;
+   }
+   if ($old_size > 0) {
+      my $factor = $size / $old_size;
+      $site->{'factors'} += $factor;
+      $site->{'factors_count'} ++;
+      $site->{'factor_max'} = $factor if ($factor > ($site->{'factor_max'} || 0));
+   }
+   $chain->{'last'} = $size;
+   $chains{$newptr} = $chain;
+}
+
+# Account a buffer that is freed (or still in use at the end of the log)
+sub chain_end {
+   my $chain = delete $chains{$_[0]};
+   return if (!defined ($chain));
+
+   my $site = \%{ $chain_sites{$chain->{'site'}} };
+   $site->{'chains'} ++;
+   $site->{'resizes'} += $chain->{'resizes'};
+   $site->{'first'} += $chain->{'first'};
+   $site->{'final'} += $chain->{'last'};
+}
+
+sub trend_sample {
+   my %callsites;
+
+   foreach my $btstr (keys %hotspots) {
+      my $size = $hotspots{$btstr}{'size'};
+      $callsites{$btstr} = $size if ($size > 0);
+   }
+   push (@trend_samples, { 'ts' => $_[0], 'callsites' => \%callsites });
+}
+
+# Account a new mapping of the address space
+sub mapping_add {
+   my ($addr, $len, $anon, $bt, $thread_id, $ts) = @_;
+   my $kind = ($anon) ? 'anon' : 'file';
+
+   sorted_insert (\@mapping_starts, $addr);
+   $mappings{$addr} = {
+      'size'      => $len,
+      'kind'      => $kind,
+      'backtrace' => $bt,
+      'thread_id' => $thread_id,
+      'timestamp' => $ts,
+   };
+   $mapped{$kind} += $len;
+   $mapped_anon_max = $mapped{'anon'} if ($mapped{'anon'} > $mapped_anon_max);
+}
+
+# Remove a range of the address space from the mappings, keeping the
+# parts of partially unmapped mappings and returning the first mapping
+# found in the range
+sub mapping_remove {
+   my ($addr, $len) = @_;
+   my $end = $addr + $len;
+   my $found;
+
+   # Mappings do not overlap: only the one before the range may extend
+   # into it
+   my $i = sorted_find (\@mapping_starts, $addr);
+   $i -- if (($i > 0) && ($mapping_starts[$i - 1] + $mappings{$mapping_starts[$i - 1]}{'size'} > $addr));
+
+   my @starts;
+   while (($i < scalar (@mapping_starts)) && ($mapping_starts[$i] < $end)) {
+      push (@starts, $mapping_starts[$i]);
+      $i ++;
+   }
+
+   foreach my $start (@starts) {
+      my $m = $mappings{$start};
+      my $m_end = $start + $m->{'size'};
+
+      $found = $m if (!defined ($found));
+      delete $mappings{$start};
+      sorted_remove (\@mapping_starts, $start);
+      $mapped{$m->{'kind'}} -= $m->{'size'};
+      if ($start < $addr) {
+         mapping_add ($start, $addr - $start, $m->{'kind'} eq 'anon', $m->{'backtrace'}, $m->{'thread_id'}, $m->{'timestamp'});
+      }
+      if ($m_end > $end) {
+         mapping_add ($end, $m_end - $end, $m->{'kind'} eq 'anon', $m->{'backtrace'}, $m->{'thread_id'}, $m->{'timestamp'});
+      }
+   }
+   return $found;
+}
+
+# Length of a mapping in whole pages
+sub mapping_length {
+   my $page = 1 << $PAGE_SHIFT;
+   return ($_[0] + $page - 1) & ~($page - 1);
+}
+
+# Account a block allocated (or released with negative bytes and blocks)
+# within a context
+sub context_account {
+   my ($context, $bytes, $blocks) = @_;
+   my $label = $context_labels{$context};
+   $label = "context #" . $context if (!defined ($label));
+
+   my $c = \%{ $context_stats{$label} };
+   $c->{'live'} += $bytes;
+   $c->{'live_blocks'} += $blocks;
+   if ($bytes > 0) {
+      $c->{'bytes'} += $bytes;
+      $c->{'allocs'} ++;
+   }
+}
+
+# Check whether a tag matches a --before/--after specification
+# (either "name" or "name:serial")
+sub tag_matches {
+   my ($spec, $name, $serial) = @_;
+
+   if ($spec =~ /^(.*):(\d+)$/) {
+      return (($name eq $1) && ($serial == $2));
+   }
+   return ($name eq $spec);
+}
+
+# Process a log entry
+sub process_event {
+   my ($serial, $ev, $ts, $thread_id, $data) = @_;
+
+   debug "LOG HEADER sz=" . length ($data) . ", serial=$serial, ev=$ev, ts=$ts, thread_id=$thread_id";
+
+   # Initialize ts_min if this is the first log entry
+   $lines = $lines + 1;
+   if ($lines eq 1) {
+      $ts_min = $ts;
+   }
+
+   # Count the serials skipped since the highest one seen as lost. Entries
+   # received late (datagrams may be reordered with --listen) were counted
+   # as lost when they were skipped.
+   if ($current_serial != 0) {
+      if ($serial > $current_serial + 1) {
+         debug "received log #$serial, " . ($current_serial + 1) . " expected!\n";
+         $logs_lost = $logs_lost + ($serial - $current_serial - 1);
+      }
+      elsif (($serial <= $current_serial) && ($logs_lost > 0)) {
+         debug "received log #$serial late\n";
+         $logs_lost = $logs_lost - 1;
+      }
+      $current_serial = $serial if ($serial > $current_serial);
+   }
+   else {
+      $current_serial = $serial;
+   }
+
+   # As memtraq logs are ordered chronogically, ts_max is the current ts
+   $ts_max = $ts;
+
+   # Sample live bytes per callsite for each --trend-window elapsed
+   if ($trend_window > 0) {
+      if (!defined ($trend_next)) {
+         $trend_next = $ts + ($trend_window * 1000000);
+      }
+      while ($ts >= $trend_next) {
+         trend_sample ($trend_next);
+         $trend_next += $trend_window * 1000000;
+      }
+   }
+
+   # INIT event (flags were added after the enabled state)
+   if ($ev == $EV_START) {
+      my ($enabled, $flags) = unpack 'II', $data;
+      $log_flags = $flags || 0;
+
+      debug "LOG INIT enabled=$enabled, flags=$log_flags";
+   }
+
+   # CONTEXT event (label not nul-terminated)
+   if ($ev == $EV_CONTEXT) {
+      my ($context) = unpack 'I', $data;
+      my $label = substr ($data, 4);
+
+      debug "LOG CONTEXT id=$context, label=$label";
+
+      $context_labels{$context} = $label;
+      $context_stats{$label}{'contexts'} ++ if ($log != 0);
+   }
+
+   # TAG event (records too short to hold a serial are ignored)
+   if (($ev == $EV_TAG) && (length ($data) >= 4)) {
+
+      # Extract tag name (not nul-terminated) and serial: the name is
+      # whatever comes before the trailing serial
+      my $name = substr ($data, 0, length ($data) - 4);
+      my ($serial) = unpack 'I', substr ($data, -4);
+
+      debug "LOG TAG name=$name, serial=$serial";
+
+      if ($trace ne '') {
+         trace_event ("{\"name\":" . trace_string ($name) . ",\"ph\":\"i\",\"s\":\"g\",\"ts\":$ts," .
+                      "\"pid\":1,\"tid\":$thread_id,\"args\":{\"serial\":$serial}}");
+      }
+
+      if ($build_index) {
+         push (@index_tags, {
+            'name'   => $name,
+            'serial' => $serial,
+            'offset' => $record_offset,
+            'ts'     => $ts,
+         });
+      }
+
+      if (($before ne '') && (tag_matches ($before, $name, $serial))) {
+         print "# reached tag '" . $before . "' (--before), no longer tracking...\n";
+         $log = 0;
+      }
+      if (($after ne '') && (tag_matches ($after, $name, $serial))) {
+         print "# reached tag '" . $after . "' (--after), tracking resumed...\n";
+         $log = 1;
+      }
+      if ($peak_window ne '') {
+         if ((!$peak_in_window{'active'}) && ($peak_in_window{'max'} < 0) &&
+             (tag_matches ($peak_from_tag, $name, $serial))) {
+            print "# reached tag '" . $peak_from_tag . "' (--peak-window), tracking peak...\n";
+            $peak_in_window{'active'} = 1;
+         }
+         elsif (($peak_in_window{'active'}) && ($peak_to_tag ne '') &&
+                (tag_matches ($peak_to_tag, $name, $serial))) {
+            print "# reached tag '" . $peak_to_tag . "' (--peak-window), peak tracking stopped...\n";
+            %peak_window_snapshot = %{ peak_snapshot (\%peak_in_window) };
+            $peak_in_window{'active'} = 0;
+         }
+      }
+      if ($diff ne '') {
+         if (($diff_state == 0) && (tag_matches ($diff_from_tag, $name, $serial))) {
+            print "# reached tag '" . $diff_from_tag . "' (--diff), taking snapshot...\n";
+            %diff_from = callsite_snapshot ();
+            $diff_state = 1;
+         }
+         elsif (($diff_state == 1) && ($diff_to_tag ne '') &&
+                (tag_matches ($diff_to_tag, $name, $serial))) {
+            print "# reached tag '" . $diff_to_tag . "' (--diff), taking snapshot...\n";
+            %diff_to = callsite_snapshot ();
+            $diff_state = 2;
+         }
+      }
+   }
+
+   # MALLOC, CALLOC and MEMALIGN events (CALLOC with the number and size of
+   # the elements, MEMALIGN with the alignment)
+   if (($ev == $EV_MALLOC) || ($ev == $EV_CALLOC) || ($ev == $EV_MEMALIGN)) {
+
+      my ($size, $ptr, @ra);
+      my $op = 'malloc';
+      if ($ev == $EV_CALLOC) {
+         my ($count, $elt_size);
+         ($count, $elt_size, $ptr, @ra) = unpack 'IIII*', $data;
+         $size = $count * $elt_size;
+         $op = 'calloc';
+         debug "LOG CALLOC count=$count, elt_size=$elt_size, ptr=$ptr";
+      }
+      elsif ($ev == $EV_MEMALIGN) {
+         my $alignment;
+         ($alignment, $size, $ptr, @ra) = unpack 'IIII*', $data;
+         $op = 'memalign';
+         debug "LOG MEMALIGN alignment=$alignment, size=$size, ptr=$ptr";
+      }
+      else {
+         ($size, $ptr, @ra) = unpack 'III*', $data;
+         debug "LOG MALLOC size=$size, ptr=$ptr";
+      }
+      my $duration = ($log_flags & $INIT_FLAG_LATENCY) ? shift (@ra) : undef;
+      my $context = ($log_flags & $INIT_FLAG_CONTEXT) ? shift (@ra) : 0;
+      my $bt = join (';', map { sprintf ("%x", $_) } @ra);
+
+      if ($log != 0) {
+         $chunks{$ptr}{'backtrace'} = $bt;
+         $chunks{$ptr}{'size'} = $size;
+         $chunks{$ptr}{'thread_id'} = $thread_id;
+         $chunks{$ptr}{'timestamp'} = $ts;
+         $chunks{$ptr}{'context'} = $context if ($context != 0);
+
+         if (!defined ($hotspots{$bt}{'size'})) {
+            $hotspots{$bt}{'allocs'} = 0;
+            $hotspots{$bt}{'frees'}  = 0;
+            $hotspots{$bt}{'size'}   = 0;
+            $hotspots{$bt}{'bytes'}  = 0;
+         }
+         $hotspots{$bt}{'allocs'} = $hotspots{$bt}{'allocs'} + 1;
+         $hotspots{$bt}{'size'}   = $hotspots{$bt}{'size'} + $size;
+         $hotspots{$bt}{'bytes'}  = $hotspots{$bt}{'bytes'} + $size;
+
+         $total = $total + $size;
+         $allocs ++;
+         $callocs ++ if ($ev == $EV_CALLOC);
+         $memaligns ++ if ($ev == $EV_MEMALIGN);
+
+         live_change ($bt, $thread_id, $size, 1);
+         record_latency ($op, $bt, $duration) if (($latency) && (defined ($duration)));
+         context_account ($context, $size, 1) if ($context != 0);
+         record_size ($bt, $size) if ($sizes);
+         sim_malloc ($ptr, $size, $ts) if ($simulate ne '');
+         page_account ($ptr, $size, 1) if ($occupancy);
+         trace_alloc ($ptr, $size, $thread_id, $ts) if ($trace ne '');
+         sharing_add ($ptr) if ($false_sharing);
+      }
+   }
+
+   # FREE and FREE_SIZED events (the latter with the size given to the sized
+   # delete operator)
+   if (($ev == $EV_FREE) || ($ev == $EV_FREE_SIZED)) {
+
+      my ($ptr, $freed_size, @ra);
+      if ($ev == $EV_FREE_SIZED) {
+         ($ptr, $freed_size, @ra) = unpack 'III*', $data;
+         debug "LOG FREE_SIZED ptr=$ptr, size=$freed_size";
+      }
+      else {
+         ($ptr, @ra) = unpack 'II*', $data;
+         debug "LOG FREE ptr=$ptr";
+      }
+      my $duration = ($log_flags & $INIT_FLAG_LATENCY) ? shift (@ra) : undef;
+      my $bt = join (';', map { sprintf ("%x", $_) } @ra);
+
+      if ($log != 0) {
+         if (defined $chunks{$ptr}) {
+            my $size = $chunks{$ptr}{'size'};
+            $total = $total - $size;
+
+            my $bt = $chunks{$ptr}{'backtrace'};
+            if (defined ($freed_size)) {
+               $sized_frees ++;
+               if ($freed_size != $size) {
+                  $sized_mismatches{$bt}{'count'} ++;
+                  $sized_mismatches{$bt}{'sizes'}{"$size/$freed_size"} ++;
+               }
+            }
+            $hotspots{$bt}{'frees'} = $hotspots{$bt}{'frees'} + 1;
+            $hotspots{$bt}{'size'}  = $hotspots{$bt}{'size'} - $size;
+
+            if ($lifetimes) {
+               record_lifetime ($bt, $ts - $chunks{$ptr}{'timestamp'});
+            }
+            live_change ($bt, $chunks{$ptr}{'thread_id'}, -$size, -1);
+            context_account ($chunks{$ptr}{'context'}, -$size, -1) if (defined ($chunks{$ptr}{'context'}));
+            record_latency ('free', $bt, $duration) if (($latency) && (defined ($duration)));
+            record_cross_free ($ptr, $thread_id, $ts) if ($cross_thread);
+            page_account ($ptr, $size, -1) if ($occupancy);
+            trace_free ($ptr, $ts) if ($trace ne '');
+            sharing_remove ($ptr) if ($false_sharing);
+            chain_end ($ptr) if ($realloc_chains);
+         }
+         else {
+            my $count = 1;
+            if (defined $unknown_frees{$bt}) {
+               $count = $count + $unknown_frees{$bt} 
+            }
+            $unknown_frees{$bt} = $count;
+         }
+
+         $frees ++;
+         delete $chunks{$ptr};
+
+         sim_free ($ptr, $ts) if ($simulate ne '');
+      }
+   }
+
+   # REALLOC event
+   if ($ev == $EV_REALLOC) {
+
+      my ($oldptr, $size, $newptr, @ra) = unpack 'IIII*', $data;
+      my $duration = ($log_flags & $INIT_FLAG_LATENCY) ? shift (@ra) : undef;
+      my $context = ($log_flags & $INIT_FLAG_CONTEXT) ? shift (@ra) : 0;
+      my $bt = join (';', map { sprintf ("%x", $_) } @ra);
+
+      debug "LOG REALLOC oldptr=$oldptr, size=$size, newptr=$newptr";
+
+      # realloc() returns NULL when it frees a block resized to 0 bytes,
+      # or when it fails and leaves the block untouched
+      my $failed = (($newptr == 0) && ($size != 0));
+
+      if (($log != 0) && (!$failed)) {
+         # The old block is gone, whether it moved or not
+         if (defined $chunks{$oldptr}) {
+            my $old_size = $chunks{$oldptr}{'size'};
+            my $old_bt   = $chunks{$oldptr}{'backtrace'};
+            $total = $total - $old_size;
+            $hotspots{$old_bt}{'size'} = $hotspots{$old_bt}{'size'} - $old_size;
+            $hotspots{$old_bt}{'frees'} = $hotspots{$old_bt}{'frees'} + 1;
+            if ($lifetimes) {
+               record_lifetime ($old_bt, $ts - $chunks{$oldptr}{'timestamp'});
+            }
+            live_change ($old_bt, $chunks{$oldptr}{'thread_id'}, -$old_size, -1);
+            context_account ($chunks{$oldptr}{'context'}, -$old_size, -1) if (defined ($chunks{$oldptr}{'context'}));
+            record_cross_free ($oldptr, $thread_id, $ts, 1) if (($cross_thread) && ($newptr != $oldptr));
+            page_account ($oldptr, $old_size, -1) if ($occupancy);
+            trace_free ($oldptr, $ts) if ($trace ne '');
+            sharing_remove ($oldptr) if ($false_sharing);
+            if ($realloc_chains) {
+               if ($newptr != 0) {
+                  chain_resize ($oldptr, $old_size, $newptr, $size, $bt);
+               }
+               else {
+                  chain_end ($oldptr);
+               }
+            }
+            delete $chunks{$oldptr};
+         }
+
+         $reallocs ++;
+         record_latency ('realloc', $bt, $duration) if (($latency) && (defined ($duration)));
+         sim_realloc ($oldptr, $size, $newptr, $ts) if ($simulate ne '');
+
+         if ($newptr != 0) {
+            $chunks{$newptr}{'backtrace'} = $bt;
+            $chunks{$newptr}{'size'} = $size;
+            $chunks{$newptr}{'thread_id'} = $thread_id;
+            $chunks{$newptr}{'timestamp'} = $ts;
+            $chunks{$newptr}{'context'} = $context if ($context != 0);
+
+            if (!defined ($hotspots{$bt}{'size'})) {
+               $hotspots{$bt}{'allocs'} = 0;
+               $hotspots{$bt}{'frees'}  = 0;
+               $hotspots{$bt}{'size'}   = 0;
+               $hotspots{$bt}{'bytes'}  = 0;
+            }
+            $hotspots{$bt}{'allocs'} = $hotspots{$bt}{'allocs'} + 1;
+            $hotspots{$bt}{'size'}   = $hotspots{$bt}{'size'} + $size;
+            $hotspots{$bt}{'bytes'}  = $hotspots{$bt}{'bytes'} + $size;
+
+            $total = $total + $size;
+
+            live_change ($bt, $thread_id, $size, 1);
+            context_account ($context, $size, 1) if ($context != 0);
+            record_size ($bt, $size) if ($sizes);
+            page_account ($newptr, $size, 1) if ($occupancy);
+            trace_alloc ($newptr, $size, $thread_id, $ts) if ($trace ne '');
+            sharing_add ($newptr) if ($false_sharing);
+         }
+      }
+   }
+
+   # MMAP event
+   if ($ev == $EV_MMAP) {
+
+      my ($addr, $len, $prot, $flags, $fd, $anon, @ra) = unpack 'IQIIIII*', $data;
+      my $bt = join (';', map { sprintf ("%x", $_) } @ra);
+
+      debug "LOG MMAP addr=$addr, len=$len, prot=$prot, flags=$flags, fd=$fd, anon=$anon";
+
+      if ($log != 0) {
+         # MAP_FIXED mappings replace whatever was mapped there
+         $len = mapping_length ($len);
+         mapping_remove ($addr, $len);
+         mapping_add ($addr, $len, $anon, $bt, $thread_id, $ts);
+         $mmaps ++;
+      }
+   }
+
+   # MUNMAP event
+   if ($ev == $EV_MUNMAP) {
+
+      my ($addr, $len) = unpack 'IQ', $data;
+
+      debug "LOG MUNMAP addr=$addr, len=$len";
+
+      if ($log != 0) {
+         mapping_remove ($addr, mapping_length ($len));
+         $munmaps ++;
+      }
+   }
+
+   # MREMAP event
+   if ($ev == $EV_MREMAP) {
+
+      my ($oldaddr, $oldlen, $newlen, $newaddr, @ra) = unpack 'IQQI*', $data;
+      my $bt = join (';', map { sprintf ("%x", $_) } @ra);
+
+      debug "LOG MREMAP oldaddr=$oldaddr, oldlen=$oldlen, newlen=$newlen, newaddr=$newaddr";
+
+      if ($log != 0) {
+         # The mapping keeps its kind and origin (mappings made before
+         # tracking started are assumed to be anonymous)
+         my $m = mapping_remove ($oldaddr, mapping_length ($oldlen));
+         my $anon = (defined ($m)) ? ($m->{'kind'} eq 'anon') : 1;
+         $newlen = mapping_length ($newlen);
+         mapping_remove ($newaddr, $newlen);
+         mapping_add ($newaddr, $newlen, $anon, (defined ($m)) ? $m->{'backtrace'} : $bt,
+                      $thread_id, (defined ($m)) ? $m->{'timestamp'} : $ts);
+      }
+   }
+
+   # SBRK and BRK events (the first break seen is the reference for the
+   # growth of the data segment)
+   if (($ev == $EV_SBRK) || ($ev == $EV_BRK)) {
+
+      my ($increment, $addr, @ra);
+      if ($ev == $EV_SBRK) {
+         ($increment, $addr, @ra) = unpack 'lI*', $data;
+         $brk_first = $addr if (!defined ($brk_first));
+         $brk_current = $addr if (!defined ($brk_current));
+         $addr = $addr + $increment;
+      }
+      else {
+         ($addr, @ra) = unpack 'I*', $data;
+         $brk_first = $addr if (!defined ($brk_first));
+         $brk_current = $addr if (!defined ($brk_current));
+      }
+      my $bt = join (';', map { sprintf ("%x", $_) } @ra);
+
+      debug "LOG BRK addr=$addr";
+
+      if ($log != 0) {
+         $brk_sites{$bt} += $addr - $brk_current;
+      }
+      $brk_current = $addr;
+   }
+
+   if ($total > $heap_max) {
+      $heap_max = $total;
+   }
+   peak_check ($ts, $serial);
+
+   heap_history_add ($ts, $total);
+
+   if (($occupancy) && (($lines % 10000) == 0)) {
+      occupancy_sample ($ts);
+   }
+}
+
+#----------------------------------------------------------------------------
+# Live report (--follow and --listen)
+#----------------------------------------------------------------------------
+
+# Time of the next live report
+my $live_next = time () + $interval;
+
+# Print the heap figures and the top live callsites as of now
+sub print_live_report {
+   my @top = sort { $hotspots{$b}{'size'} <=> $hotspots{$a}{'size'} }
+             grep { $hotspots{$_}{'size'} > 0 } keys %hotspots;
+   splice (@top, $top_count) if (scalar (@top) > $top_count);
+
+   # Decode callsites not seen in previous reports (in this process, the
+   # symbol cache is written on exit)
+   foreach my $btstr (@top) {
+      collect_addresses ($btstr);
+   }
+   decode_pending (1);
+
+   my ($heap_label, $heap_unit) = B_max_label ($total);
+   my ($max_label, $max_unit) = B_max_label ($heap_max);
+   my ($t_label, $t_unit) = t_max_label ($ts_max - $ts_min);
+   $heap_label =~ s/^ +//;
+   $max_label  =~ s/^ +//;
+   $t_label    =~ s/^ +//;
+
+   print "\n";
+   print "Live report at " . strftime ("%H:%M:%S", localtime ()) .
+      " (log time +" . $t_label . $t_unit . "):\n";
+   print "-------------------------------------------\n";
+   print "heap: " . $heap_label . $heap_unit . " in use (" . keys(%chunks) .
+      " blocks), peak " . $max_label . $max_unit . "\n";
+   print $allocs . " allocs, " . $frees . " frees, " . $reallocs . " reallocs, " .
+      $logs_lost . " log entries lost\n";
+   print "\n";
+   foreach my $btstr (@top) {
+      my %result = get_caller_info ($btstr);
+      my $loc = (%result) ? $result{'loc'} : $btstr;
+      my $size = $hotspots{$btstr}{'size'};
+      my $blocks = $hotspots{$btstr}{'allocs'} - $hotspots{$btstr}{'frees'};
+      printf ("%12u bytes %8u blocks  %s\n", $size, $blocks, $loc);
+   }
+   STDOUT->flush ();
+}
+
+sub check_live_report {
+   # Nothing to report until the first log entry
+   if (($lines > 0) && (time () >= $live_next)) {
+      print_live_report ();
+      $live_next = time () + $interval;
+   }
+}
+
+#----------------------------------------------------------------------------
+# Read log
+#----------------------------------------------------------------------------
+
+# Bytes read from the log that were not processed yet
+my $log_buffer = '';
+
+# Offset in the log of the next byte to be returned by log_read()
+my $log_offset = 0;
+
+# Set on SIGINT to stop following the log
+my $log_stop = 0;
+
+# Get more bytes from the log file or socket. Returns the number
+# of bytes received.
+sub log_fill {
+   my $data = '';
+
+   if ($listen ne '') {
+      if (IO::Select->new ($sock)->can_read (0.25)) {
+         $sock->recv ($data, 65536);
+      }
+   }
+   else {
+      sysread (LOG, $data, 65536);
+   }
+   if (length ($data) > 0) {
+      $log_buffer .= $data;
+      if ($save ne '') {
+         print SAVE $data;
+      }
+   }
+   return length ($data);
+}
+
+# Read the requested number of bytes from the log. In --follow and
+# --listen modes, wait for more data instead of stopping at the end of
+# the log and refresh the live report while doing so.
+sub log_read {
+   my $n = $_[0];
+
+   while (length ($log_buffer) < $n) {
+      next if (log_fill () > 0);
+      return undef if (($follow == 0) || ($log_stop != 0));
+      check_live_report ();
+      if ($listen eq '') {
+         select (undef, undef, undef, 0.25);
+      }
+   }
+   $log_offset += $n;
+   return substr ($log_buffer, 0, $n, '');
+}
+
+# Move to another place of the log file
+sub log_seek {
+   my $offset = $_[0];
+
+   sysseek (LOG, $offset, 0) or die("Could not seek log to " . $offset . "!");
+   $log_buffer = '';
+   $log_offset = $offset;
+}
+
+#----------------------------------------------------------------------------
+# Log index (--build-index)
+#----------------------------------------------------------------------------
+
+# The index file holds checkpoints of the analysis state (the live set)
+# taken every --checkpoint-interval entries, each preceded by the entries
+# added to the heap, trend and occupancy histories since the previous one,
+# followed by a table of contents listing tags and checkpoints with their
+# offsets in the log:
+#
+#   "MTQIDX02" (history checkpoint)... toc toc-offset (64-bit)
+
+my $INDEX_MAGIC = "MTQIDX02";
+
+# Analyses whose state is saved in checkpoints: --at only restores a
+# checkpoint of an index built with the same ones
+sub index_analyses {
+   my @analyses;
+
+   push (@analyses, 'lifetimes') if ($lifetimes);
+   push (@analyses, 'sizes=' . $size_classes) if ($sizes);
+   push (@analyses, 'cross-thread') if ($cross_thread);
+   push (@analyses, 'false-sharing=' . $cache_line) if ($false_sharing);
+   push (@analyses, 'realloc-chains') if ($realloc_chains);
+   push (@analyses, 'latency') if ($latency);
+   push (@analyses, 'occupancy=' . $sparse_page) if ($occupancy);
+   push (@analyses, 'trend-window=' . $trend_window) if ($trend_window > 0);
+   return join (',', @analyses);
+}
+
+# Analyses needing all the events of the log (the allocator models, the
+# tags of --diff and --peak-window and the --trace timeline are not saved
+# in the index): the log is then read from its start
+my $index_replay = (($simulate ne '') || ($diff ne '') || ($peak_window ne '') || ($trace ne ''));
+
+# Digest of the head of the log, to check that an index belongs to it
+sub log_digest {
+   my $size = $_[0];
+   my $head = '';
+
+   open (DIGEST, '<', $ARGV[0]) or return '';
+   binmode (DIGEST);
+   read (DIGEST, $head, ($size < 65536) ? $size : 65536);
+   close (DIGEST);
+   return Digest::MD5::md5_hex ($head);
+}
+
+# History entries already saved in the index
+my $history_saved = 0;
+my $trend_saved = 0;
+my $occupancy_saved = 0;
+
+# Point in time to stop the analysis at (--at): a log timestamp, a log
+# serial ("#serial") or seconds from the start of the log ("+seconds")
+my $at_ts = -1;
+my $at_serial = -1;
+
+if ($at ne '') {
+   if (($follow != 0) || ($listen ne '')) {
+      die("--at cannot be used with --follow or --listen!");
+   }
+   if ($at =~ /^#(\d+)$/) {
+      $at_serial = $1;
+   }
+   elsif ($at =~ /^\+(\d+(\.\d*)?)$/) {
+      my $seconds = $1;
+      my $data = log_read (28);
+      if (defined ($data)) {
+         my ($sz, $serial, $ev, $ts) = unpack 'IQIQ', $data;
+         $at_ts = $ts + int ($seconds * 1000000);
+      }
+      log_seek (0);
+   }
+   elsif ($at =~ /^(\d+)$/) {
+      $at_ts = $1;
+   }
+   else {
+      die("Invalid --at value '" . $at . "' (use timestamp, #serial or +seconds)!");
+   }
+}
+
+# State of the analysis, as saved in checkpoints
+sub get_state {
+   return {
+      'chunks'         => \%chunks,
+      'hotspots'       => \%hotspots,
+      'lifetimes'      => \%lifetimes,
+      'sizes'          => \%sizes_by_callsite,
+      'sizes_total'    => \%sizes_total,
+      'peak'           => peak_snapshot (\%peak),
+      'cross_pairs'    => \%cross_pairs,
+      'cross_callsites' => \%cross_callsites,
+      'cross_frees'    => $cross_frees,
+      'cross_reallocs' => $cross_reallocs,
+      'sharing_pairs'  => \%sharing_pairs,
+      'sharing_count'  => $sharing_count,
+      'chains'         => \%chains,
+      'chain_sites'    => \%chain_sites,
+      'unknown_frees'  => \%unknown_frees,
+      'total'          => $total,
+      'allocs'         => $allocs,
+      'frees'          => $frees,
+      'reallocs'       => $reallocs,
+      'callocs'        => $callocs,
+      'memaligns'      => $memaligns,
+      'sized_frees'    => $sized_frees,
+      'sized_mismatches' => \%sized_mismatches,
+      'context_labels' => \%context_labels,
+      'context_stats'  => \%context_stats,
+      'heap_max'       => $heap_max,
+      'logs_lost'      => $logs_lost,
+      'current_serial' => $current_serial,
+      'log_flags'      => $log_flags,
+      'lines'          => $lines,
+      'ts_min'         => $ts_min,
+      'ts_max'         => $ts_max,
+      'trend_next'     => $trend_next,
+      'latency_ops'    => \%latency_ops,
+      'latency_sites'  => \%latency_sites,
+      'mappings'       => \%mappings,
+      'mapped'         => \%mapped,
+      'mapped_anon_max' => $mapped_anon_max,
+      'mmaps'          => $mmaps,
+      'munmaps'        => $munmaps,
+      'brk_first'      => $brk_first,
+      'brk_current'    => $brk_current,
+      'brk_sites'      => \%brk_sites,
+   };
+}
+
+sub set_state {
+   my $state = $_[0];
+
+   %chunks         = %{ $state->{'chunks'} };
+   %hotspots       = %{ $state->{'hotspots'} };
+   %lifetimes      = %{ $state->{'lifetimes'} || {} };
+   %sizes_by_callsite = %{ $state->{'sizes'} || {} };
+   %sizes_total    = %{ $state->{'sizes_total'} || {} };
+   %cross_pairs    = %{ $state->{'cross_pairs'} || {} };
+   %cross_callsites = %{ $state->{'cross_callsites'} || {} };
+   $cross_frees    = $state->{'cross_frees'} || 0;
+   $cross_reallocs = $state->{'cross_reallocs'} || 0;
+   %sharing_pairs  = %{ $state->{'sharing_pairs'} || {} };
+   $sharing_count  = $state->{'sharing_count'} || 0;
+   %chains         = %{ $state->{'chains'} || {} };
+   %chain_sites    = %{ $state->{'chain_sites'} || {} };
+
+   # Page, cache line and thread usage are rebuilt from the live blocks
+   %page_live = ();
+   ($page_spans, $page_sparse, $page_min, $page_max) = (0, 0, undef, undef);
+   %line_blocks = ();
+   %thread_live = ();
+   foreach my $ptr (keys %chunks) {
+      page_account ($ptr, $chunks{$ptr}{'size'}, 1) if ($occupancy);
+      if ($false_sharing) {
+         $line_blocks{$_}{$ptr} = 1 foreach (cache_lines ($ptr, $chunks{$ptr}{'size'}));
+      }
+      $thread_live{$chunks{$ptr}{'thread_id'}} += $chunks{$ptr}{'size'};
+   }
+
+   # Changes made since the peak
+   my $p = $state->{'peak'};
+   if (defined ($p)) {
+      my %callsites = callsite_snapshot ();
+      $peak{'max'}    = $p->{'max'};
+      $peak{'ts'}     = $p->{'ts'};
+      $peak{'serial'} = $p->{'serial'};
+      $peak{'since'}  = {};
+      $peak{'since_threads'} = {};
+      foreach my $btstr (keys %callsites, keys %{ $p->{'callsites'} }) {
+         my $now = $callsites{$btstr} || { 'bytes' => 0, 'blocks' => 0 };
+         my $then = $p->{'callsites'}{$btstr} || { 'bytes' => 0, 'blocks' => 0 };
+         $peak{'since'}{$btstr} = { 'bytes'  => $now->{'bytes'} - $then->{'bytes'},
+                                    'blocks' => $now->{'blocks'} - $then->{'blocks'} };
+      }
+      foreach my $thread_id (keys %thread_live, keys %{ $p->{'threads'} }) {
+         $peak{'since_threads'}{$thread_id} = ($thread_live{$thread_id} || 0) - ($p->{'threads'}{$thread_id} || 0);
+      }
+   }
+   %unknown_frees  = %{ $state->{'unknown_frees'} };
+   $total          = $state->{'total'};
+   $allocs         = $state->{'allocs'};
+   $frees          = $state->{'frees'};
+   $reallocs       = $state->{'reallocs'};
+   $callocs        = $state->{'callocs'} || 0;
+   $memaligns      = $state->{'memaligns'} || 0;
+   $sized_frees    = $state->{'sized_frees'} || 0;
+   %sized_mismatches = %{ $state->{'sized_mismatches'} || {} };
+   %context_labels = %{ $state->{'context_labels'} || {} };
+   %context_stats  = %{ $state->{'context_stats'} || {} };
+   $heap_max       = $state->{'heap_max'};
+   $logs_lost      = $state->{'logs_lost'};
+   $current_serial = $state->{'current_serial'};
+   $log_flags      = $state->{'log_flags'} || 0;
+   $lines          = $state->{'lines'};
+   $ts_min         = $state->{'ts_min'};
+   $ts_max         = $state->{'ts_max'};
+   $trend_next     = $state->{'trend_next'};
+   %latency_ops    = %{ $state->{'latency_ops'} || {} };
+   %latency_sites  = %{ $state->{'latency_sites'} || {} };
+   %mappings       = %{ $state->{'mappings'} || {} };
+   @mapping_starts = sort { $a <=> $b } keys %mappings;
+   %mapped         = %{ $state->{'mapped'} || { 'anon' => 0, 'file' => 0 } };
+   $mapped_anon_max = $state->{'mapped_anon_max'} || 0;
+   $mmaps          = $state->{'mmaps'} || 0;
+   $munmaps        = $state->{'munmaps'} || 0;
+   $brk_first      = $state->{'brk_first'};
+   $brk_current    = $state->{'brk_current'};
+   %brk_sites      = %{ $state->{'brk_sites'} || {} };
+}
+
+# Save a checkpoint of the analysis, the log is to be replayed from
+# the current offset when restoring it
+sub write_checkpoint {
+   my $ts = $_[0];
+
+   my $history_offset = tell (INDEX);
+   my $blob = nfreeze ({
+      'heap'      => [ @heap_history[$history_saved .. $#heap_history] ],
+      'trend'     => [ @trend_samples[$trend_saved .. $#trend_samples] ],
+      'occupancy' => [ @occupancy_history[$occupancy_saved .. $#occupancy_history] ],
+   });
+   print INDEX pack ('Q', length ($blob)) . $blob;
+   $history_saved = scalar (@heap_history);
+   $trend_saved = scalar (@trend_samples);
+   $occupancy_saved = scalar (@occupancy_history);
+
+   push (@index_checkpoints, {
+      'offset'  => $log_offset,
+      'serial'  => $current_serial,
+      'ts'      => $ts,
+      'history' => $history_offset,
+      'state'   => tell (INDEX),
+   });
+   $blob = nfreeze (get_state ());
+   print INDEX pack ('Q', length ($blob)) . $blob;
+}
+
+sub write_index {
+   my $toc = nfreeze ({
+      'log_size'    => $log_offset,
+      'log_digest'  => log_digest ($log_offset),
+      'log_flags'   => $log_flags,
+      'analyses'    => index_analyses (),
+      'contexts'    => \%context_labels,
+      'tags'        => \@index_tags,
+      'checkpoints' => \@index_checkpoints,
+   });
+   my $toc_offset = tell (INDEX);
+   print INDEX $toc . pack ('Q', $toc_offset);
+   close (INDEX);
+}
+
+# Load the table of contents of an index, returns undef if the index
+# does not exist or does not match the log
+sub read_index {
+   my $file = $_[0];
+
+   open (INDEX, '<', $file) or return undef;
+   binmode (INDEX);
+
+   my ($magic, $trailer);
+   my $size = -s $file;
+   if (($size < 16) || (read (INDEX, $magic, 8) != 8) || ($magic ne $INDEX_MAGIC)) {
+      print STDERR "warning: ignoring invalid index '" . $file . "'!\n";
+      close (INDEX);
+      return undef;
+   }
+   seek (INDEX, $size - 8, 0);
+   read (INDEX, $trailer, 8);
+   my ($toc_offset) = unpack ('Q', $trailer);
+   seek (INDEX, $toc_offset, 0);
+   read (INDEX, my $data, $size - 8 - $toc_offset);
+   my $toc = thaw ($data);
+
+   if ((!defined ($toc)) || ((-s LOG) < $toc->{'log_size'}) ||
+       ($toc->{'log_digest'} ne log_digest ($toc->{'log_size'}))) {
+      print STDERR "warning: index '" . $file . "' does not match the log!\n";
+      close (INDEX);
+      return undef;
+   }
+   # INDEX is kept open for reading checkpoints
+   return $toc;
+}
+
+# Read a block of data saved in the index
+sub read_index_blob {
+   my $offset = $_[0];
+
+   seek (INDEX, $offset, 0);
+   read (INDEX, my $data, 8);
+   my ($len) = unpack ('Q', $data);
+   read (INDEX, $data, $len);
+   return thaw ($data);
+}
+
+# Restore the analysis state saved in a checkpoint and the histories saved
+# up to it
+sub read_checkpoint {
+   my ($toc, $cp) = @_;
+
+   foreach my $c (@{ $toc->{'checkpoints'} }) {
+      my $history = read_index_blob ($c->{'history'});
+      push (@heap_history, @{ $history->{'heap'} });
+      push (@trend_samples, @{ $history->{'trend'} });
+      push (@occupancy_history, @{ $history->{'occupancy'} });
+      last if ($c == $cp);
+   }
+   set_state (read_index_blob ($cp->{'state'}));
+}
+
+# Offset at which to start reading the log (-1 to stop reading)
+my $start_offset = 0;
+my $stop_offset = -1;
+
+if ($build_index) {
+   open (INDEX, '>', $index) or die("Could not create index " . $index . "!");
+   binmode (INDEX);
+   print INDEX $INDEX_MAGIC;
+}
+elsif (($listen eq '') && ($follow == 0) && (($after ne '') || ($before ne '')) &&
+       (!$index_replay) && (!$occupancy) && ($trend_window == 0)) {
+   # Occupancy and trend samples are also taken outside of the window
+   my $toc = read_index ($index);
+   if (defined ($toc)) {
+      my @tags = @{ $toc->{'tags'} };
+      $log_flags = $toc->{'log_flags'} || 0;
+      %context_labels = %{ $toc->{'contexts'} || {} };
+      debug "using index '$index' (" . scalar (@tags) . " tags)";
+
+      # Nothing is tracked before the --after tag: jump to it
+      my @after_tags = grep { tag_matches ($after, $_->{'name'}, $_->{'serial'}) } @tags;
+      if ($after ne '') {
+         if (scalar (@after_tags) > 0) {
+            $start_offset = $after_tags[0]{'offset'};
+         }
+         else {
+            # Tracking would never resume
+            $start_offset = $toc->{'log_size'};
+         }
+      }
+
+      # Stop reading at the first --before tag that is not followed by
+      # an --after tag (tracking would not resume after it)
+      if ($before ne '') {
+         foreach my $t (@tags) {
+            next if ($t->{'offset'} < $start_offset);
+            next if (!tag_matches ($before, $t->{'name'}, $t->{'serial'}));
+            next if (grep { $_->{'offset'} > $t->{'offset'} } @after_tags);
+            $stop_offset = $t->{'offset'};
+            last;
+         }
+      }
+      if ($start_offset > 0) {
+         debug "seeking log to offset $start_offset";
+         log_seek ($start_offset);
+      }
+   }
+}
+elsif ($at ne '') {
+   my $toc = read_index ($index);
+   if ((defined ($toc)) && ($index_replay)) {
+      print "# replaying the log from its start (for --simulate, --diff, --peak-window or --trace)\n";
+   }
+   elsif ((defined ($toc)) && ($toc->{'analyses'} ne index_analyses ())) {
+      print "# index built for other analyses (" . (($toc->{'analyses'} ne '') ? $toc->{'analyses'} : "none") .
+         "), replaying the log from its start\n";
+   }
+   elsif (defined ($toc)) {
+      # Replay from the last checkpoint taken before the requested time
+      my $checkpoint;
+      foreach my $cp (@{ $toc->{'checkpoints'} }) {
+         last if (($at_ts >= 0) && ($cp->{'ts'} > $at_ts));
+         last if (($at_serial >= 0) && ($cp->{'serial'} > $at_serial));
+         $checkpoint = $cp;
+      }
+      if (defined ($checkpoint)) {
+         print "# replaying from checkpoint at log entry #" . $checkpoint->{'serial'} . "\n";
+         read_checkpoint ($toc, $checkpoint);
+         log_seek ($checkpoint->{'offset'});
+      }
+   }
+}
+
+if ($follow != 0) {
+   $SIG{'INT'} = sub { $log_stop = 1; };
+}
+
+if ($trace ne '') {
+   open (TRACE, '>', $trace) or die("Could not create " . $trace . "!");
+   print TRACE "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+}
+
+while (defined (my $data = log_read (28))) {
+
+   $record_offset = $log_offset - 28;
+
+   my ($sz, $serial, $ev, $ts, $thread_id) = unpack 'IQIQI', $data;
+   last if ($sz < 28);
+
+   # Reached the point in time requested with --at
+   last if (($at_ts >= 0) && ($ts > $at_ts));
+   last if (($at_serial >= 0) && ($serial > $at_serial));
+
+   $data = log_read ($sz - 28);
+   last if (!defined ($data));
+
+   process_event ($serial, $ev, $ts, $thread_id, $data);
+
+   # Rest of the log is outside of the --before/--after window
+   last if (($stop_offset >= 0) && ($record_offset >= $stop_offset));
+
+   if ($build_index) {
+      if ($lines == 1) {
+         $checkpoint_next_ts = $ts + ($checkpoint_seconds * 1000000);
+      }
+      if ((($lines % $checkpoint_interval) == 0) ||
+          (($checkpoint_seconds > 0) && ($ts >= $checkpoint_next_ts))) {
+         write_checkpoint ($ts);
+         $checkpoint_next_ts = $ts + ($checkpoint_seconds * 1000000);
+      }
+   }
+
+   if ($follow != 0) {
+      last if ($log_stop != 0);
+      check_live_report ();
+   }
+}
+if ($listen ne '') {
+   close ($sock);
+}
+else {
+   close (LOG);
+}
+if ($save ne '') {
+   close (SAVE);
+}
+if ($trace ne '') {
+   # Large blocks still in use end with the log
+   foreach my $ptr (sort { $trace_blocks{$a} <=> $trace_blocks{$b} } keys %trace_blocks) {
+      trace_event ("{\"name\":\"" . $chunks{$ptr}{'size'} . " bytes\",\"cat\":\"block\",\"ph\":\"e\"," .
+                   "\"id\":" . $trace_blocks{$ptr} . ",\"ts\":$ts_max,\"pid\":1,\"tid\":" . $chunks{$ptr}{'thread_id'} . "}");
+   }
+   print TRACE "\n]}\n";
+   close (TRACE);
+   print "# trace written to '" . $trace . "'\n";
+}
+# Last (partial) trend window
+if (($trend_window > 0) && ($lines > 0)) {
+   trend_sample ($ts_max);
+}
+if (($occupancy) && ($lines > 0) && (($lines % 10000) != 0)) {
+   occupancy_sample ($ts_max);
+}
+
+if ($peak_in_window{'active'}) {
+   if ($peak_to_tag ne '') {
+      print "# tag '" . $peak_to_tag . "' (--peak-window) not found, using end of log...\n";
+   }
+   %peak_window_snapshot = %{ peak_snapshot (\%peak_in_window) };
+}
+elsif (($peak_window ne '') && ($peak_in_window{'max'} < 0)) {
+   print "# tag '" . $peak_from_tag . "' (--peak-window) not found!\n";
+}
+
+if ($diff_state == 1) {
+   if ($diff_to_tag ne '') {
+      print "# tag '" . $diff_to_tag . "' (--diff) not found, using end of log...\n";
+   }
+   %diff_to = callsite_snapshot ();
+   $diff_state = 2;
+}
+elsif (($diff ne '') && ($diff_state == 0)) {
+   print "# tag '" . $diff_from_tag . "' (--diff) not found!\n";
+}
+
+# No log entries (e.g. --after tag not found)
+if ($lines == 0) {
+   $ts_min = 0;
+   $ts_max = 0;
+}
+if ($at ne '') {
+   print "# state at " . (($at_serial >= 0) ? "log entry #$at_serial" : "timestamp $at_ts") .
+      " (--at)\n";
+}
+if ($build_index) {
+   write_index ();
+   print "# index written to '" . $index . "' (" . scalar (@index_tags) . " tags, " .
+      scalar (@index_checkpoints) . " checkpoints)\n";
+}
+
+print "\n";
+print "Summary:\n";
+print "--------\n";
+print "\n";
+
+print $total . " bytes (" . keys(%chunks) . " blocks) in use\n";
+print $allocs . " allocs (" . $callocs . " callocs, " . $memaligns . " aligned), " . $frees . " frees (" .
+   $sized_frees . " sized), " . $reallocs . " reallocs\n";
+if (scalar (keys %unknown_frees) > 0) {
+   print "Note: " . scalar(keys %unknown_frees) . " frees for unknown blocks!\n";
+}
+if (scalar (keys %sized_mismatches) > 0) {
+   my $count = 0;
+   $count += $_->{'count'} foreach (values %sized_mismatches);
+   print "Note: " . $count . " sized deletes with another size than the one of the block!\n";
+}
+if (($mmaps > 0) || (defined ($brk_first))) {
+   print $mapped{'anon'} . " bytes (" . scalar (grep { $_->{'kind'} eq 'anon' } values %mappings) .
+      " mappings) mapped anonymously, " . $mapped{'file'} . " bytes mapped from files (max anonymous " .
+      $mapped_anon_max . " bytes)\n";
+   print $mmaps . " mmaps, " . $munmaps . " munmaps\n";
+   if (defined ($brk_first)) {
+      print "" . ($brk_current - $brk_first) . " bytes added to the program break\n";
+   }
+}
+print "$logs_lost log entries lost!\n";
+print "\n";
+
+my $time_total = $ts_max - $ts_min;
+my $time_incr = $time_total / $graph_cols;
+my $heap_incr = $heap_max / $graph_rows;
+
+my @graph;
+my $x;
+my $y;
+
+my ($y_label, $y_unit) = B_max_label ($heap_max);
+my ($x_label, $x_unit) = t_max_label ($ts_max - $ts_min);
+
+# Initialize (erase) graph
+for ($x = 1; $x <= $graph_cols; $x++) {
+   for ($y = 1; $y <= $graph_rows; $y++) {
+      $graph[$x][$y] = ' ';
+   }
+}
+
+# Fill heap history graph
+my $samples = scalar (@heap_history);
+for (my $i = 0; $i < $samples; $i ++) {
+   my $ts = $heap_history[$i]{'timestamp'};
+   my $heap = $heap_history[$i]{'heap'};
+   $ts = $ts - $ts_min;
+   $x = $ts / $time_incr;
+   $y = $heap / $heap_incr;
+   for (my $j = 1; $j <= $y; $j ++) {
+      $graph[$x][$j] = ':';
+   }
+}
+undef @heap_history;
+
+# Print X and Y axis
+$graph[0][0] = '+';                                            # axes join point
+for ($x = 1; $x <= $graph_cols; $x++) { $graph[$x][0] = '-'; } # X-axis
+for ($y = 1; $y <= $graph_rows; $y++) { $graph[0][$y] = '|'; } # Y-axis
+$graph[$graph_cols][0] = '>';                                  # X-axis arrow
+$graph[0][$graph_rows] = '^';                                  # Y-axis arrow 
+
+printf("    %2s\n", $y_unit);
+for ($y = $graph_rows; $y >= 0; $y--) {
+   if ($graph_rows == $y) {          # top row
+      print($y_label);
+    } elsif (0 == $y) {              # bottom row
+       print("   0 ");
+    } else {                         # anywhere else
+        print("     ");
+    }
+
+    # Axis and data for the row.
+    for ($x = 0; $x <= $graph_cols; $x++) {
+       printf("%s", $graph[$x][$y]);
+    }
+    if (0 == $y) {
+       print("$x_unit\n");
+    } else {
+       print("\n");
+    }
+}
+printf("     0%s%5s\n", ' ' x ($graph_cols-5), $x_label);
+undef @graph;
+
+#----------------------------------------------------------------------------
+# Decode all addresses
+#----------------------------------------------------------------------------
+
+print "\n";
+
+# First pass, get all the addresses we need to decode per object
+# Effectively building a hash of hashes where the 1st level are
+# the objects and the 2nd level the addresses from that object.
+# Also check memory usage on a per object and on a per thread
+# basis.
+foreach my $ptr (keys %chunks) {
+   my $btstr = $chunks{$ptr}{'backtrace'};
+   my $thread_id = $chunks{$ptr}{'thread_id'};
+   my @bt = split (/\;/, $btstr);
+   if (defined $bt[1]) {
+      my $obj = object_from_addr ($bt[1]);
+      if (defined ($obj)) {
+         if (defined ($usage_by_objects{$obj})) {
+            $usage_by_objects{$obj} += $chunks{$ptr}{'size'};
+         }
+         else {
+            $usage_by_objects{$obj} = $chunks{$ptr}{'size'};
+         }
+      }
+      if (defined ($usage_by_threads{$thread_id})) {
+         $usage_by_threads{$thread_id} += $chunks{$ptr}{'size'};
+      }
+      else {
+         $usage_by_threads{$thread_id} = $chunks{$ptr}{'size'};
+      }
+   }
+   collect_addresses ($btstr);
+}
+
+# Decode addresses from callstacks collected for unknown_frees and sized
+# deletes of the wrong size
+foreach my $btstr (keys %unknown_frees, keys %sized_mismatches) {
+   collect_addresses ($btstr);
+}
+
+decode_pending ();
+
+#----------------------------------------------------------------------------
+# Dump all blocks still in memory
+#----------------------------------------------------------------------------
+
+if ($show_all) {
+    print "\n";
+    print "Listing of all memory blocks still allocated:\n";
+    print "---------------------------------------------\n";
+}
+
+my $idx = 1;
+foreach my $ptr (keys %chunks) {
+    my $thread_id = $chunks{$ptr}{'thread_id'};
+
+    if(!defined($chunks{$ptr}{'size'})) {
+       print "warn: $ptr does not have size!\n";
+    }
+
+    if ($show_all) {
+        print "\nblock #" . $idx . ": block of " . $chunks{$ptr}{'size'} . " bytes not freed\n";
+        print "\taddress  : " . $ptr . "\n";
+        print "\ttimestamp: " . $chunks{$ptr}{'timestamp'} . "\n";
+        print "\tthread   : " . $thread_id . "\n";
+        print "\tcallstack:\n";
+    }
+
+    my $btstr = $chunks{$ptr}{'backtrace'};
+    my @bt = split (/\;/, $btstr);
+    if ($show_all) {
+       foreach $a (@bt) {
+           my %result = decode ($a);
+           print "\t\t" . $result{'loc'} . "\n";
+       }
+    }
+    $idx = $idx + 1;
+}
+
+print "\n";
+print "Current heap utilization by modules:\n";
+print "------------------------------------\n";
+print "\n";
+
+foreach my $obj (keys %usage_by_objects) {
+   my $sz = $usage_by_objects{$obj};
+   printf ("%-40s %24u (%3d%%)\n", basename ($obj), $sz, ($sz * 100) / $total);
+}
+printf ("%-40s %24u (100%%)\n", "TOTAL", $total);
+
+print "\n";
+print "Current heap utilization by threads:\n";
+print "------------------------------------\n";
+print "\n";
+
+foreach my $thr (keys %usage_by_threads) {
+   my $sz = $usage_by_threads{$thr};
+   printf ("%-40s %24u (%3d%%)\n", "thread " . $thr, $sz, ($sz * 100) / $total);
+}
+printf ("%-40s %24u (100%%)\n", "TOTAL", $total);
+
+if ($show_grouped) {
+
+    if ($live_report ne '') {
+       open (REPORT, '>', $live_report);
+    }
+
+    print "\n";
+    print "Allocated blocks grouped by callstacks:\n";
+    print "---------------------------------------\n";
+
+    foreach my $btstr (sort {$hotspots{$b}{'size'} <=> $hotspots{$a}{'size'} } keys %hotspots) {
+        next if ($hotspots{$btstr}{'size'} == 0);
+        my $allocs = $hotspots{$btstr}{'allocs'};
+        my $frees  = $hotspots{$btstr}{'frees'};
+        my $size   = $hotspots{$btstr}{'size'};
+        my $total  = $allocs + $frees;
+        my $ratio  = floor ($allocs * 100 / $total);
+        print "\n";
+        print $allocs . " allocation(s) ($ratio% alive) for a total of " . 
+            $size . " bytes from:\n";
+        my @bt = split (/\;/, $btstr);
+        foreach my $a (@bt) {
+            my %result = decode ($a);
+            print "\t\t" . $result{'loc'} . "\n";
+        }
+        if ($live_report ne '') {
+           my %result = get_caller_info ($btstr);
+	   if (%result) {
+              my $obj    = $result{'object'};
+              my $loc    = $result{'loc'};
+              my $dir    = $result{'dir'};
+              my $file   = $result{'file'};
+              my $line   = $result{'line'};
+              my $method = $result{'method'};
+              print REPORT "$obj;$dir;$file;$line;$method;$allocs;$frees;$size\n";
+           }
+        }
+    }
+    if ($live_report ne '') {
+       close (REPORT);
+    }
+}
+
+#----------------------------------------------------------------------------
+# Dump unknown frees
+#----------------------------------------------------------------------------
+
+if (($show_unknown) && (scalar (keys %unknown_frees) > 0)) {
+
+    print "\n";
+    print "Free operations without a matching allocation:\n";
+    print "----------------------------------------------\n";
+
+    foreach my $btstr (sort {$unknown_frees{$b} <=> $unknown_frees{$a}} keys %unknown_frees) {
+       print "\n";
+       print $unknown_frees{$btstr} . " free(s) from:\n";
+       my @bt = split (/\;/, $btstr);
+       foreach my $a (@bt) {
+          my %result = decode ($a);
+          print "\t\t" . $result{'loc'} . "\n";
+       }
+   }
+}
+
+if (($show_unknown) && (scalar (keys %sized_mismatches) > 0)) {
+
+    print "\n";
+    print "Sized deletes not matching the size of the block:\n";
+    print "-------------------------------------------------\n";
+
+    foreach my $btstr (sort {$sized_mismatches{$b}{'count'} <=> $sized_mismatches{$a}{'count'}} keys %sized_mismatches) {
+       my $sizes = $sized_mismatches{$btstr}{'sizes'};
+       print "\n";
+       print $sized_mismatches{$btstr}{'count'} . " delete(s) (allocated/deleted sizes: " .
+          join (', ', map { "$_ ($sizes->{$_})" } sort { $sizes->{$b} <=> $sizes->{$a} } keys %{ $sizes }) .
+          ") of blocks from:\n";
+       my @bt = split (/\;/, $btstr);
+       foreach my $a (@bt) {
+          my %result = decode ($a);
+          print "\t\t" . $result{'loc'} . "\n";
+       }
+   }
+}
+
+#----------------------------------------------------------------------------
+# Peak heap (--peak-window)
+#----------------------------------------------------------------------------
+
+sub print_peak_report {
+   my ($title, $p) = @_;
+   my $callsites = $p->{'callsites'};
+   my $threads = $p->{'threads'};
+
+   my @sites = sort { $callsites->{$b}{'bytes'} <=> $callsites->{$a}{'bytes'} } keys %{ $callsites };
+   splice (@sites, $top_count) if (scalar (@sites) > $top_count);
+   foreach my $btstr (@sites) {
+      collect_addresses ($btstr);
+   }
+   decode_pending ();
+
+   my ($t, $t_unit) = t_max_label ($p->{'ts'} - $ts_min);
+   $t =~ s/^ +//;
+
+   print "\n";
+   print $title . ":\n";
+   print "-" x length ($title) . "-\n";
+   print "\n";
+   print $p->{'max'} . " bytes in use at " . $t . $t_unit . " (log entry #" . $p->{'serial'} . ")\n";
+   print "\n";
+   foreach my $thread_id (sort { $threads->{$b} <=> $threads->{$a} } keys %{ $threads }) {
+      next if ($threads->{$thread_id} <= 0);
+      my $fmt = "\tthread %-10u %10u bytes %5.1f%%\n";
+      printf ($fmt, $thread_id, $threads->{$thread_id}, $threads->{$thread_id} * 100 / $p->{'max'});
+   }
+   foreach my $btstr (@sites) {
+      my $c = $callsites->{$btstr};
+      print "\n";
+      print $c->{'bytes'} . " bytes (" . sprintf ("%.1f%%", $c->{'bytes'} * 100 / $p->{'max'}) . ") in " .
+         $c->{'blocks'} . " blocks from:\n";
+      foreach my $loc (callsite_locs ($btstr)) {
+         print "\t\t" . $loc . "\n";
+      }
+   }
+}
+
+if (($show_peak) && ($peak{'max'} > 0)) {
+   print_peak_report ("Live blocks at peak heap", peak_snapshot (\%peak));
+}
+if ((%peak_window_snapshot) && ($peak_window_snapshot{'max'} > 0)) {
+   print_peak_report ("Live blocks at peak heap between '" . $peak_from_tag . "' and '" .
+      (($peak_to_tag ne '') ? $peak_to_tag : "end of log") . "'", \%peak_window_snapshot);
+}
+
+#----------------------------------------------------------------------------
+# Heap growth (--diff, --diff-snapshot and --snapshot)
+#----------------------------------------------------------------------------
+
+# Name a callsite independently of where objects were loaded, so that
+# callsites can be compared between runs of the same build
+sub normalize_callsite {
+   my @bt = split (/\;/, $_[0]);
+   my @frames;
+
+   foreach my $a (@bt) {
+      my $obj = object_from_addr ($a);
+      if ($obj ne "unknown") {
+         push (@frames, sprintf ("%s+%x", basename ($obj),
+            hex ($a) - $objects{$obj}{'start'} + $objects{$obj}{'pgoff'}));
+      }
+      else {
+         push (@frames, $a);
+      }
+   }
+   return join (';', @frames);
+}
+
+# Decoded frames of a callsite
+sub callsite_locs {
+   my @bt = split (/\;/, $_[0]);
+   return map { my %result = decode ($_); $result{'loc'} } @bt;
+}
+
+# Print callsites sorted by growth of their live bytes. Entries are
+# hashes with from/to bytes and blocks and the decoded frames.
+sub print_growth_report {
+   my ($title, @entries) = @_;
+
+   print "\n";
+   print $title . ":\n";
+   print "-" x length ($title) . "-\n";
+
+   my $from_total = 0;
+   my $to_total = 0;
+   foreach my $e (@entries) {
+      $from_total += $e->{'from_bytes'};
+      $to_total   += $e->{'to_bytes'};
+      $e->{'delta'} = $e->{'to_bytes'} - $e->{'from_bytes'};
+   }
+   printf ("\n%+d bytes (%u -> %u bytes in use)\n", $to_total - $from_total, $from_total, $to_total);
+
+   my @grown  = sort { $b->{'delta'} <=> $a->{'delta'} } grep { $_->{'delta'} > 0 } @entries;
+   my @shrunk = sort { $a->{'delta'} <=> $b->{'delta'} } grep { $_->{'delta'} < 0 } @entries;
+   splice (@grown,  $top_count) if (scalar (@grown)  > $top_count);
+   splice (@shrunk, $top_count) if (scalar (@shrunk) > $top_count);
+
+   foreach my $e (@grown, @shrunk) {
+      my $blocks = $e->{'to_blocks'} - $e->{'from_blocks'};
+      print "\n";
+      my $fmt = "%+d bytes (%+d blocks), %u -> %u bytes from:\n";
+      printf ($fmt, $e->{'delta'}, $blocks, $e->{'from_bytes'}, $e->{'to_bytes'});
+      foreach my $loc (@{ $e->{'locs'} }) {
+         print "\t\t" . $loc . "\n";
+      }
+   }
+}
+
+if ($diff_state == 2) {
+   my @entries;
+   my %callsites = (%diff_from, %diff_to);
+
+   foreach my $btstr (keys %callsites) {
+      collect_addresses ($btstr);
+   }
+   decode_pending ();
+
+   foreach my $btstr (keys %callsites) {
+      my $from = $diff_from{$btstr};
+      my $to   = $diff_to{$btstr};
+      push (@entries, {
+         'from_bytes'  => (defined ($from)) ? $from->{'bytes'}  : 0,
+         'from_blocks' => (defined ($from)) ? $from->{'blocks'} : 0,
+         'to_bytes'    => (defined ($to))   ? $to->{'bytes'}    : 0,
+         'to_blocks'   => (defined ($to))   ? $to->{'blocks'}   : 0,
+         'locs'        => [ callsite_locs ($btstr) ],
+      });
+   }
+   my $to_name = ($diff_to_tag ne '') ? "tag '" . $diff_to_tag . "'" : "end of log";
+   print_growth_report ("Heap growth between tag '" . $diff_from_tag . "' and " . $to_name, @entries);
+}
+
+if (($snapshot ne '') || ($diff_snapshot ne '')) {
+   my %current;
+   my %callsites = callsite_snapshot ();
+
+   foreach my $btstr (keys %callsites) {
+      collect_addresses ($btstr);
+   }
+   decode_pending ();
+
+   # Callsites of this run under their normalized names
+   foreach my $btstr (keys %callsites) {
+      my $key = normalize_callsite ($btstr);
+      $current{$key}{'bytes'}  += $callsites{$btstr}{'bytes'};
+      $current{$key}{'blocks'} += $callsites{$btstr}{'blocks'};
+      $current{$key}{'locs'}    = [ callsite_locs ($btstr) ];
+   }
+
+   if ($snapshot ne '') {
+      nstore (\%current, $snapshot) or die("Could not write snapshot " . $snapshot . "!");
+      print "# snapshot of " . scalar (keys %current) . " callsites written to '" . $snapshot . "'\n";
+   }
+
+   if ($diff_snapshot ne '') {
+      my $baseline = retrieve ($diff_snapshot) or die("Could not read snapshot " . $diff_snapshot . "!");
+      my @entries;
+      my %keys = (%{ $baseline }, %current);
+
+      foreach my $key (keys %keys) {
+         my $from = $baseline->{$key};
+         my $to   = $current{$key};
+         push (@entries, {
+            'from_bytes'  => (defined ($from)) ? $from->{'bytes'}  : 0,
+            'from_blocks' => (defined ($from)) ? $from->{'blocks'} : 0,
+            'to_bytes'    => (defined ($to))   ? $to->{'bytes'}    : 0,
+            'to_blocks'   => (defined ($to))   ? $to->{'blocks'}   : 0,
+            'locs'        => (defined ($to))   ? $to->{'locs'}     : $from->{'locs'},
+         });
+      }
+      print_growth_report ("Heap growth since snapshot '" . $diff_snapshot . "'", @entries);
+   }
+}
+
+#----------------------------------------------------------------------------
+# Allocator latency (--latency)
+#----------------------------------------------------------------------------
+
+sub latency_label {
+   my $ns = $_[0];
+   return $ns . "ns" if ($ns < 1000);
+   return sprintf ("%.3gus", $ns / 1000) if ($ns < 1000000);
+   return lifetime_label ($ns / 1000);
+}
+
+if ($latency) {
+   print "\n";
+   print "Allocator latency:\n";
+   print "------------------\n";
+
+   if (!($log_flags & $INIT_FLAG_LATENCY)) {
+      print "\n";
+      print "No durations in this log (set MEMTRAQ_LATENCY=1 on the target)\n";
+   }
+
+   foreach my $op ('malloc', 'calloc', 'memalign', 'realloc', 'free') {
+      my $l = $latency_ops{$op};
+      next if (!defined ($l));
+
+      print "\n";
+      print $l->{'count'} . " calls to " . $op . ": mean " . latency_label (int ($l->{'sum'} / $l->{'count'})) .
+         ", p50 < " . latency_label (lifetime_percentile ($l, 50)) . ", p99 < " . latency_label (lifetime_percentile ($l, 99)) .
+         ", max " . latency_label ($l->{'max'}) . "\n";
+
+      my $max = 0;
+      foreach my $count (@{ $l->{'buckets'} }) {
+         $max = $count if (defined ($count) && ($count > $max));
+      }
+      for (my $bucket = 0; $bucket < scalar (@{ $l->{'buckets'} }); $bucket ++) {
+         my $count = $l->{'buckets'}[$bucket] || 0;
+         next if ($count == 0);
+         my $from = ($bucket == 0) ? 0 : (1 << ($bucket - 1));
+         my $fmt = "\t%8s - %-8s %-40s %u\n";
+         printf ($fmt, latency_label ($from), latency_label (1 << $bucket), '#' x int (($count * 40 + $max - 1) / $max), $count);
+      }
+   }
+
+   # Callsites spending the most time in the allocator (blocks they
+   # allocated being freed included)
+   my @sites = sort { $latency_sites{$b}{'sum'} <=> $latency_sites{$a}{'sum'} } keys %latency_sites;
+   splice (@sites, $top_count) if (scalar (@sites) > $top_count);
+   foreach my $btstr (@sites) {
+      collect_addresses ($btstr);
+   }
+   decode_pending ();
+
+   foreach my $btstr (@sites) {
+      my $l = $latency_sites{$btstr};
+      print "\n";
+      print "" . latency_label ($l->{'sum'}) . " in " . $l->{'count'} . " calls (mean " . latency_label (int ($l->{'sum'} / $l->{'count'})) .
+         ", p99 < " . latency_label (lifetime_percentile ($l, 99)) . ", max " . latency_label ($l->{'max'}) . ") for blocks from:\n";
+      foreach my $loc (callsite_locs ($btstr)) {
+         print "\t\t" . $loc . "\n";
+      }
+   }
+}
+
+#----------------------------------------------------------------------------
+# Memory mappings (--mappings)
+#----------------------------------------------------------------------------
+
+if ($mappings) {
+   my %sites;
+
+   foreach my $m (values %mappings) {
+      next if ($m->{'kind'} ne 'anon');
+      $sites{$m->{'backtrace'}}{'bytes'} += $m->{'size'};
+      $sites{$m->{'backtrace'}}{'count'} ++;
+   }
+   my @sites = sort { $sites{$b}{'bytes'} <=> $sites{$a}{'bytes'} } keys %sites;
+   splice (@sites, $top_count) if (scalar (@sites) > $top_count);
+   my @brk = sort { $brk_sites{$b} <=> $brk_sites{$a} } grep { $brk_sites{$_} != 0 } keys %brk_sites;
+   splice (@brk, $top_count) if (scalar (@brk) > $top_count);
+   foreach my $btstr (@sites, @brk) {
+      collect_addresses ($btstr);
+   }
+   decode_pending ();
+
+   print "\n";
+   print "Memory mappings:\n";
+   print "----------------\n";
+   print "\n";
+   print $mapped{'anon'} . " bytes mapped anonymously next to " . $total . " bytes of heap blocks\n";
+
+   foreach my $btstr (@sites) {
+      print "\n";
+      print $sites{$btstr}{'bytes'} . " bytes in " . $sites{$btstr}{'count'} . " anonymous mappings from:\n";
+      foreach my $loc (callsite_locs ($btstr)) {
+         print "\t\t" . $loc . "\n";
+      }
+   }
+   foreach my $btstr (@brk) {
+      print "\n";
+      print $brk_sites{$btstr} . " bytes added to the program break from:\n";
+      foreach my $loc (callsite_locs ($btstr)) {
+         print "\t\t" . $loc . "\n";
+      }
+   }
+}
+
+#----------------------------------------------------------------------------
+# Contexts (--contexts)
+#----------------------------------------------------------------------------
+
+if ($contexts) {
+   print "\n";
+   print "Contexts:\n";
+   print "---------\n";
+   print "\n";
+
+   if (!($log_flags & $INIT_FLAG_CONTEXT)) {
+      print "No contexts in this log (set MEMTRAQ_CONTEXT=1 on the target)\n";
+   }
+   else {
+      my $fmt = "%-40s %8s %12s %8s %14s %10s %12s\n";
+      my $print_contexts = sub {
+         my ($title, $key) = @_;
+         my @labels = sort { ($context_stats{$b}{$key} || 0) <=> ($context_stats{$a}{$key} || 0) } keys %context_stats;
+         splice (@labels, $top_count) if (scalar (@labels) > $top_count);
+
+         print $title . ":\n";
+         printf ($fmt, "context", "count", "live bytes", "blocks", "allocated", "allocs", "per context");
+         foreach my $label (@labels) {
+            my $c = $context_stats{$label};
+            my $count = $c->{'contexts'} || 0;
+            my $per_context = ($count > 0) ? int (($c->{'bytes'} || 0) / $count) : "-";
+            printf ($fmt, $label, $count, $c->{'live'} || 0, $c->{'live_blocks'} || 0, $c->{'bytes'} || 0, $c->{'allocs'} || 0, $per_context);
+         }
+      };
+      $print_contexts->("Top contexts by live bytes", 'live');
+      print "\n";
+      $print_contexts->("Top contexts by allocated bytes", 'bytes');
+   }
+}
+
+#----------------------------------------------------------------------------
+# Cross-thread frees (--cross-thread)
+#----------------------------------------------------------------------------
+
+if ($cross_thread) {
+   my $duration = ($ts_max - $ts_min) / 1000000;
+   my $rate = sub {
+      return ($duration > 0) ? sprintf ("%.1f/s", $_[0] / $duration) : "n/a";
+   };
+   my $lifetimes = sub {
+      my $e = $_[0];
+      return "p50 < " . lifetime_label (lifetime_percentile ($e, 50)) . ", p99 < " .
+         lifetime_label (lifetime_percentile ($e, 99));
+   };
+
+   my @sites = sort { $cross_callsites{$b}{'count'} <=> $cross_callsites{$a}{'count'} } keys %cross_callsites;
+   splice (@sites, $top_count) if (scalar (@sites) > $top_count);
+   foreach my $btstr (@sites) {
+      collect_addresses ($btstr);
+   }
+   decode_pending ();
+
+   print "\n";
+   print "Cross-thread frees:\n";
+   print "-------------------\n";
+   print "\n";
+   print $cross_frees . " of " . $frees . " frees (" .
+      (($frees > 0) ? sprintf ("%.1f%%", $cross_frees * 100 / $frees) : "-") .
+      ") from another thread than the allocating one\n";
+   print $cross_reallocs . " of " . $reallocs . " reallocs moved a block from another thread\n";
+   print "\n";
+
+   my $fmt = "%12s -> %-12s %10s %10s %12s  %s\n";
+   printf ($fmt, "allocated by", "freed by", "frees", "rate", "bytes", "lifetimes");
+   my @pairs = sort { $cross_pairs{$b}{'count'} <=> $cross_pairs{$a}{'count'} } keys %cross_pairs;
+   splice (@pairs, $top_count) if (scalar (@pairs) > $top_count);
+   foreach my $pair (@pairs) {
+      my $e = $cross_pairs{$pair};
+      my ($from, $to) = split (/>/, $pair);
+      printf ($fmt, $from, $to, $e->{'count'}, $rate->($e->{'count'}), $e->{'bytes'}, $lifetimes->($e));
+   }
+
+   foreach my $btstr (@sites) {
+      my $e = $cross_callsites{$btstr};
+      my $pairs = $e->{'pairs'};
+      print "\n";
+      my $moves = ($e->{'reallocs'}) ? ", " . $e->{'reallocs'} . " by moving reallocs" : "";
+      print $e->{'count'} . " of " . $hotspots{$btstr}{'frees'} . " frees from another thread (" . $rate->($e->{'count'}) .
+         $moves . ", " . $e->{'bytes'} . " bytes, " . $lifetimes->($e) . ") for blocks from:\n";
+      foreach my $loc (callsite_locs ($btstr)) {
+         print "\t\t" . $loc . "\n";
+      }
+      print "\tthreads: " . join (', ', map { my ($f, $t) = split (/>/, $_); "$f -> $t ($pairs->{$_})" }
+         sort { $pairs->{$b} <=> $pairs->{$a} } keys %{ $pairs }) . "\n";
+   }
+}
+
+#----------------------------------------------------------------------------
+# False sharing (--false-sharing)
+#----------------------------------------------------------------------------
+
+if ($false_sharing) {
+   # Lines currently shared by live blocks of different threads
+   my $shared_lines = 0;
+   foreach my $line (keys %line_blocks) {
+      my %threads = map { $chunks{$_}{'thread_id'} => 1 } keys %{ $line_blocks{$line} };
+      $shared_lines ++ if (scalar (keys %threads) > 1);
+   }
+
+   my @pairs = sort { $sharing_pairs{$b}{'count'} <=> $sharing_pairs{$a}{'count'} } keys %sharing_pairs;
+   splice (@pairs, $top_count) if (scalar (@pairs) > $top_count);
+   foreach my $key (@pairs) {
+      collect_addresses ($_) foreach (split (/\n/, $key));
+   }
+   decode_pending ();
+
+   print "\n";
+   print "Cache lines shared by threads:\n";
+   print "------------------------------\n";
+   print "\n";
+   print $sharing_count . " blocks allocated on a " . $cache_line . "-byte cache line holding a block of another thread, " .
+      $shared_lines . " lines shared at the end of the log\n";
+
+   foreach my $key (@pairs) {
+      my ($first, $second) = split (/\n/, $key);
+      my $threads = $sharing_pairs{$key}{'threads'};
+      $second = $first if (!defined ($second));
+
+      print "\n";
+      print $sharing_pairs{$key}{'count'} . " times (threads " .
+         join (', ', map { "$_: $threads->{$_}" } sort { $threads->{$b} <=> $threads->{$a} } keys %{ $threads }) .
+         ") between blocks from:\n";
+      foreach my $loc (callsite_locs ($first)) {
+         print "\t\t" . $loc . "\n";
+      }
+      print "\tand blocks from" . (($first eq $second) ? " the same callsite" : ":") . "\n";
+      if ($first ne $second) {
+         foreach my $loc (callsite_locs ($second)) {
+            print "\t\t" . $loc . "\n";
+         }
+      }
+   }
+}
+
+#----------------------------------------------------------------------------
+# Realloc chains (--realloc-chains)
+#----------------------------------------------------------------------------
+
+if ($realloc_chains) {
+   # Buffers still in use end with the log
+   chain_end ($_) foreach (keys %chains);
+
+   my ($moved, $in_place, $copied) = (0, 0, 0);
+   foreach my $site (values %chain_sites) {
+      $moved += $site->{'moved'} || 0;
+      $in_place += $site->{'in_place'} || 0;
+      $copied += $site->{'copied'} || 0;
+   }
+
+   my @sites = sort { ($chain_sites{$b}{'copied'} || 0) <=> ($chain_sites{$a}{'copied'} || 0) } keys %chain_sites;
+   splice (@sites, $top_count) if (scalar (@sites) > $top_count);
+   foreach my $btstr (@sites) {
+      collect_addresses ($btstr);
+   }
+   decode_pending ();
+
+   print "\n";
+   print "Realloc chains:\n";
+   print "---------------\n";
+   print "\n";
+   print "" . ($moved + $in_place) . " reallocs of known blocks: " . $moved . " moved (" . sim_label ($copied) . " copied), " .
+      $in_place . " in place\n";
+
+   foreach my $btstr (@sites) {
+      my $s = $chain_sites{$btstr};
+      my $factor = ($s->{'factors_count'}) ? sprintf ("%.2f", $s->{'factors'} / $s->{'factors_count'}) : "-";
+
+      print "\n";
+      print "" . sim_label ($s->{'copied'} || 0) . " copied by " . ($s->{'moved'} || 0) . " moves (" . ($s->{'in_place'} || 0) .
+         " in place) of " . $s->{'chains'} . " buffers, " . sprintf ("%.1f", $s->{'resizes'} / $s->{'chains'}) .
+         " resizes per buffer from " . int ($s->{'first'} / $s->{'chains'}) . " to " . int ($s->{'final'} / $s->{'chains'}) .
+         " bytes on average, growth factor " . $factor . " (max " . sprintf ("%.2f", $s->{'factor_max'} || 0) . "), from:\n";
+      foreach my $loc (callsite_locs ($btstr)) {
+         print "\t\t" . $loc . "\n";
+      }
+   }
+}
+
+#----------------------------------------------------------------------------
+# Allocator simulation (--simulate)
+#----------------------------------------------------------------------------
+
+sub sim_label {
+   my ($label, $unit) = B_max_label ($_[0]);
+   $label =~ s/^ +//;
+   return $label . $unit;
+}
+
+sub sim_percent {
+   my ($part, $whole) = @_;
+   return ($whole > 0) ? sprintf ("%.1f%%", $part * 100 / $whole) : "-";
+}
+
+if (scalar (@sim_models) > 0) {
+   print "\n";
+   print "Allocator simulation:\n";
+   print "---------------------\n";
+
+   foreach my $m (@sim_models) {
+      my $footprint = $m->{'footprint'} + ($m->{'brk'} || 0);
+      my $peak = $m->{'peak'};
+      my ($peak_ts, $peak_unit) = t_max_label ($peak->{'ts'} - $ts_min);
+      $peak_ts =~ s/^ +//;
+
+      print "\n";
+      print $m->{'title'} . ":\n";
+      foreach my $state ([ "end of log", $footprint, $m->{'allocated'}, $m->{'requested'} ],
+                         [ "peak at " . $peak_ts . $peak_unit, $peak->{'footprint'}, $peak->{'allocated'}, $peak->{'requested'} ]) {
+         my ($when, $fp, $allocated, $requested) = @{ $state };
+         print "\t" . $when . ": footprint " . sim_label ($fp) . " for " . sim_label ($requested) . " requested\n";
+         print "\t\tinternal fragmentation " . sim_label ($allocated - $requested) . " (" . sim_percent ($allocated - $requested, $fp) . ")\n";
+         print "\t\texternal fragmentation " . sim_label ($fp - $allocated) . " (" . sim_percent ($fp - $allocated, $fp) . ")\n";
+      }
+   }
+
+   # Highest footprint of each model over 10 slices of the log
+   my $slices = 10;
+   my $slice = ($ts_max - $ts_min) / $slices;
+   my @peaks;
+
+   for (my $i = 0; $i < scalar (@sim_models); $i ++) {
+      foreach my $sample (@{ $sim_models[$i]{'history'} }) {
+         my $s = ($slice > 0) ? int (($sample->[0] - $ts_min) / $slice) : 0;
+         $s = $slices - 1 if ($s >= $slices);
+         if ((!defined ($peaks[$s][$i])) || ($sample->[1] > $peaks[$s][$i])) {
+            $peaks[$s][$i] = $sample->[1];
+         }
+      }
+   }
+
+   print "\n";
+   print "Peak footprint over time:\n";
+   print "\n";
+   print sprintf ("%10s", "until") . join ('', map { sprintf ("%18s", $_->{'title'}) } @sim_models) . "\n";
+   for (my $s = 0; $s < $slices; $s ++) {
+      my ($t, $unit) = t_max_label (($s + 1) * $slice);
+      print sprintf ("%8s%-2s", $t, $unit);
+      for (my $i = 0; $i < scalar (@sim_models); $i ++) {
+         print sprintf ("%18s", defined ($peaks[$s][$i]) ? sim_label ($peaks[$s][$i]) : "-");
+      }
+      print "\n";
+   }
+}
+
+#----------------------------------------------------------------------------
+# Address-space occupancy (--occupancy)
+#----------------------------------------------------------------------------
+
+if (($occupancy) && (scalar (@occupancy_history) > 0)) {
+   my $page_size = 1 << $PAGE_SHIFT;
+
+   print "\n";
+   print "Address-space occupancy:\n";
+   print "------------------------\n";
+   print "\n";
+
+   # At most 20 rows, evenly picked from the samples
+   my $rows = scalar (@occupancy_history);
+   my $step = ($rows > 20) ? ($rows - 1) / 19 : 1;
+   my $fmt = "%10s %10s %8s %6s %8s %8s %10s\n";
+   printf ($fmt, "time", "live", "pages", "used", "spans", "holes", "sparse");
+   for (my $r = 0; $r < $rows; $r += $step) {
+      my $o = $occupancy_history[int ($r + 0.5)];
+      my ($t, $t_unit) = t_max_label ($o->{'ts'} - $ts_min);
+      my $used = ($o->{'pages'} > 0) ? $o->{'live'} * 100 / ($o->{'pages'} * $page_size) : 0;
+      $fmt = "%8s%-2s %10s %8u %5.1f%% %8u %8u %10u\n";
+      printf ($fmt, $t, $t_unit, sim_label ($o->{'live'}), $o->{'pages'}, $used, $o->{'spans'}, $o->{'holes'}, $o->{'sparse'});
+   }
+
+   # Callsites with live blocks on sparse pages: they keep pages resident
+   # that would otherwise be empty
+   my %pinned;
+   my $sparse = $page_sparse;
+   foreach my $ptr (keys %chunks) {
+      my $size = $chunks{$ptr}{'size'} || 1;
+      my %seen;
+      for (my $page = $ptr >> $PAGE_SHIFT; ($page << $PAGE_SHIFT) < $ptr + $size; $page ++) {
+         next if ($page_live{$page} >= $sparse_page);
+         my $bt = $chunks{$ptr}{'backtrace'};
+         $pinned{$bt}{'pages'}{$page} = 1;
+         $pinned{$bt}{'bytes'} += $chunks{$ptr}{'size'} if (!$seen{$bt} ++);
       }
    }
-   foreach $a (@bt) {
-      my $obj = object_from_addr ($a);
-      if ($obj ne "unknown") {
-         $objects{$obj}{$a} = "???";
+
+   my @sites = sort { (scalar (keys %{ $pinned{$b}{'pages'} }) <=> scalar (keys %{ $pinned{$a}{'pages'} })) || ($a cmp $b) } keys %pinned;
+   splice (@sites, $top_count) if (scalar (@sites) > $top_count);
+
+   foreach my $btstr (@sites) {
+      collect_addresses ($btstr);
+   }
+   decode_pending ();
+
+   print "\n";
+   print $sparse . " pages with less than " . $sparse_page . " live bytes (" . sim_label ($sparse * $page_size) . ")\n";
+   foreach my $btstr (@sites) {
+      print "\n";
+      print scalar (keys %{ $pinned{$btstr}{'pages'} }) . " sparse pages pinned by " . $pinned{$btstr}{'bytes'} . " bytes from:\n";
+      foreach my $loc (callsite_locs ($btstr)) {
+         print "\t\t" . $loc . "\n";
       }
    }
 }
 
-# Decode addresses from callstacks collected for unknown_frees
-foreach my $btstr (keys %unknown_frees) {
-   my @bt = split (/\;/, $btstr);
-   foreach $a (@bt) {
-      my $obj = object_from_addr ($a);
-      if ($obj ne "unknown") {
-         $objects{$obj}{$a} = "???";
-      }
+#----------------------------------------------------------------------------
+# Allocation lifetimes (--lifetimes)
+#----------------------------------------------------------------------------
+
+# Upper bound (in microseconds) of the histogram bucket holding the given
+# percentile
+sub lifetime_percentile {
+   my ($l, $percent) = @_;
+   my $wanted = $l->{'count'} * $percent / 100;
+   my $seen = 0;
+   my $bucket;
+
+   for ($bucket = 0; $bucket < scalar (@{ $l->{'buckets'} }); $bucket ++) {
+      $seen += $l->{'buckets'}[$bucket] || 0;
+      last if ($seen >= $wanted);
    }
+   return 1 << $bucket;
 }
 
-# Find files and their load offsets
-foreach my $obj (keys %objects) {
-   my $file = $obj;
-   my @paths_array = split (/:/, $paths);
-   $objects{$obj}{'file'} = '';
-   foreach my $p (@paths_array) {
-      if (-e $p . $obj) {
-         $file = $p . $obj;
-      }
-      elsif (-e $p . "/" . basename ($obj)) {
-         $file = $p . "/" . basename ($obj);
-      }
+sub lifetime_label {
+   my ($label, $unit) = t_max_label ($_[0]);
+   $label =~ s/^ +//;
+   return $label . $unit;
+}
+
+if ($lifetimes) {
+   my $duration = ($ts_max - $ts_min) / 1000000;
+   my @sites = sort { $lifetimes{$b}{'short'} <=> $lifetimes{$a}{'short'} }
+               grep { ($lifetimes{$_}{'short'} || 0) > 0 } keys %lifetimes;
+   my $short_total = 0;
+
+   $short_total += $lifetimes{$_}{'short'} foreach (@sites);
+   splice (@sites, $top_count) if (scalar (@sites) > $top_count);
+
+   foreach my $btstr (@sites) {
+      collect_addresses ($btstr);
    }
-   debug "Checking for $file...";
-   if (-e $file) {
-      $objects{$obj}{'file'} = $file;
-      my $type = `file -L -b $file`;
-      if ($type =~ / executable,/) {
-         $exec = $file;
-         $objects{$obj}{'offset'} = 0;
+   decode_pending ();
+
+   print "\n";
+   print "Short-lived allocations:\n";
+   print "------------------------\n";
+   print "\n";
+   print $short_total . " blocks freed less than " . lifetime_label ($short_lived) . " after their allocation\n";
+
+   foreach my $btstr (@sites) {
+      my $l = $lifetimes{$btstr};
+      my $rate = ($duration > 0) ? sprintf ("%.1f/s", $l->{'short'} / $duration) : "n/a";
+      my $max = 0;
+
+      print "\n";
+      print $l->{'short'} . " of " . $l->{'count'} . " blocks short-lived (" . $rate . "), p50 < " .
+         lifetime_label (lifetime_percentile ($l, 50)) . ", p99 < " .
+         lifetime_label (lifetime_percentile ($l, 99)) . ", from:\n";
+      foreach my $loc (callsite_locs ($btstr)) {
+         print "\t\t" . $loc . "\n";
       }
-      else {
-         my $offset = `$objdump -h $file |grep ' .text '|awk '{ print \$4; }'`;
-         $offset =~ s/\n//g;
-         $objects{$obj}{'offset'} = hex ($offset);
+
+      foreach my $count (@{ $l->{'buckets'} }) {
+         $max = $count if (defined ($count) && ($count > $max));
+      }
+      for (my $bucket = 0; $bucket < scalar (@{ $l->{'buckets'} }); $bucket ++) {
+         my $count = $l->{'buckets'}[$bucket] || 0;
+         next if ($count == 0);
+         my $from = ($bucket == 0) ? 0 : (1 << ($bucket - 1));
+         my $fmt = "\t%8s - %-8s %-40s %u\n";
+         printf ($fmt, lifetime_label ($from), lifetime_label (1 << $bucket), '#' x int (($count * 40 + $max - 1) / $max), $count);
       }
    }
 }
 
-if (-e $exec) {
-   my $cmd = "$gdb --quiet";
-   debug "gdb command = $cmd";
-   my $pid = open2 (*RP, *WP, $cmd);
-   my $line;
-   foreach my $obj (keys %objects) {
-      my $file   = $objects{$obj}{'file'};
-      my $start  = $objects{$obj}{'start'};
-      my $offset = $objects{$obj}{'offset'};
-      if ((defined ($start)) && (defined ($offset))) {
-         # the parent process has an offset of zero
-         if ($offset > 0) {
-            my $a = $start + $offset;
-            debug ">gdb: " . sprintf ("add-symbol-file $file 0x%x", $a);
-            print WP sprintf ("add-symbol-file $file 0x%x\n", $a);
-            #$line = <RP>; # skip "add symbol table from file..."
-            #$line = <RP>; # skip ".text_addr = ..."
-            #$line = <RP>; # skip "(y or n)..."
-            #$line = <RP>; # skip "Reading symbols from..."
-         }
-         else {
-            debug ">gdb: symbol-file $file";
-            print WP "symbol-file $file\n";
-         }
+#----------------------------------------------------------------------------
+# Allocation sizes (--sizes)
+#----------------------------------------------------------------------------
 
-         # Skip all messages printed by gdb until "Reading symbols from"
-         do {
-            $line = <RP>;
-            $line =~ s/\n//;
-            debug ">gdb: $line";
-         } while ($line !~ /Reading symbols from/);
+sub size_class_label {
+   my $class = $_[0];
 
-         # Loop for decoding all addresses we need from that object
-         for my $a ( keys %{ $objects{$obj} } ) {
+   if ($size_classes eq 'pow2') {
+      my $from = ($class == 1) ? 0 : ($class >> 1) + 1;
+      return $from . "-" . $class;
+   }
+   return $class;
+}
 
-            # Skip special entries from the objects hash
-            next if ($a eq "file");
-            next if ($a eq "start");
-            next if ($a eq "offset");
+if ($sizes) {
+   my $count = 0;
 
-            # Get gdb to resolve this address
-            debug ">gdb: info line *0x$a";
-            print WP "info line *0x$a\n";
-            $line = <RP>;
-            $line =~ s/\n//g;
-            debug "<gdb: '$line'";
+   $count += $sizes_total{$_}{'count'} foreach (keys %sizes_total);
 
-            my $method = '';
-            my $file   = '';
-            my $dir    = '';
-            my $num    = '';
-            my $loc    = sprintf ("%s: ??? [%s]", $a, basename ($obj));
+   my @classes = sort { $sizes_total{$b}{'count'} <=> $sizes_total{$a}{'count'} } keys %sizes_total;
+   splice (@classes, $top_count) if (scalar (@classes) > $top_count);
 
-            # No debugging information but the symbol could be resolved
-            if ($line =~ /No line number information available for address 0x[0-9a-f]+ <([A-Za-z0-9_:, ()<>&*]+)\+\d+>/) {
-               $method = $1;
-               $loc    = $method;
-               $loc    = sprintf ("%s: %s [%s]", $a, $method, basename ($obj));
-               debug "matched to symbol $method";
-            }
-            # File & line information found
-            elsif ($line =~ /Line (\d+) of "([^"]+)" starts at address 0x[0-9a-f]+ <([A-Za-z0-9_:, ()<>&*]+)\+\d+>/) {
-               $num    = $1;
-               $file   = $2;
-               $method = $3;
-               $loc    = sprintf ("%s: %s <%s:%u> [%s]", $a, $method, $file, $num, basename ($obj));
-               debug "matched to $file:$line ($method)";
-            }
-            elsif ($line =~ /A problem internal to GDB has been detected,/) {
-               $line = <RP>; # skip "further debugging may prove unreliable."
-               $line = <RP>; # skip "Quit this debugging session? (y or n)..."
-               $line = <RP>;
-               $line =~ s/\n//g;
-            }
- 
-            if ($file ne '') {
-               $dir  = dirname ($file);
-               $file = basename ($file);
-            }
- 
-            $hsyms{$a}{'object'} = $obj;
-            $hsyms{$a}{'loc'}    = $loc;
-            $hsyms{$a}{'dir'}    = $dir;
-            $hsyms{$a}{'file'}   = $file;
-            $hsyms{$a}{'line'}   = $num;
-            $hsyms{$a}{'method'} = $method;
-         }
+   my @sites = sort { $hotspots{$b}{'allocs'} <=> $hotspots{$a}{'allocs'} } keys %sizes_by_callsite;
+   splice (@sites, $top_count) if (scalar (@sites) > $top_count);
 
-         # unload symbol file(s)
-         print WP "symbol-file\n";
-      }
-      # File could not be loaded
-      else {
-         for my $a ( keys %{ $objects{$obj} } ) {
+   foreach my $btstr (@sites) {
+      collect_addresses ($btstr);
+   }
+   decode_pending ();
 
-            # Skip special entries from the objects hash
-            next if ($a eq "file");
-            next if ($a eq "start");
-            next if ($a eq "offset");
+   print "\n";
+   print "Top size classes:\n";
+   print "-----------------\n";
+   print "\n";
+   my $fmt = "%15s %10s %6s %10s\n";
+   printf ($fmt, "size", "blocks", "%", "bytes");
+   foreach my $class (@classes) {
+      my ($bytes, $unit) = B_max_label ($sizes_total{$class}{'bytes'});
+      $fmt = "%15s %10u %5.1f%% %8s%s\n";
+      printf ($fmt, size_class_label ($class), $sizes_total{$class}{'count'}, $sizes_total{$class}{'count'} * 100 / $count, $bytes, $unit);
+   }
 
-            my $loc = sprintf ("%s: ??? [%s]", $a, basename ($obj));
+   print "\n";
+   print "Size distribution of the busiest callsites:\n";
+   print "-------------------------------------------\n";
 
-            $hsyms{$a}{'object'} = $obj;
-            $hsyms{$a}{'loc'}    = $loc;
-            $hsyms{$a}{'dir'}    = '';
-            $hsyms{$a}{'file'}   = '';
-            $hsyms{$a}{'line'}   = '';
-            $hsyms{$a}{'method'} = '';
-         }
+   foreach my $btstr (@sites) {
+      my $classes = $sizes_by_callsite{$btstr};
+      my $max = 0;
+
+      foreach my $class (keys %{ $classes }) {
+         $max = $classes->{$class} if ($classes->{$class} > $max);
+      }
+
+      print "\n";
+      print $hotspots{$btstr}{'allocs'} . " blocks in " . scalar (keys %{ $classes }) . " size classes from:\n";
+      foreach my $loc (callsite_locs ($btstr)) {
+         print "\t\t" . $loc . "\n";
+      }
+      foreach my $class (sort { $a <=> $b } keys %{ $classes }) {
+         $fmt = "\t%15s %-40s %u\n";
+         printf ($fmt, size_class_label ($class), '#' x int (($classes->{$class} * 40 + $max - 1) / $max), $classes->{$class});
       }
    }
-   print WP "quit\n";
-   close (RP);
-   close (WP);
 }
 
 #----------------------------------------------------------------------------
-# Dump all blocks still in memory
+# Leak trends (--trend-window)
 #----------------------------------------------------------------------------
 
-if ($show_all) {
-    print "\n";
-    print "Listing of all memory blocks still allocated:\n";
-    print "---------------------------------------------\n";
+# Least-squares fit of y over x, returns slope and coefficient of
+# determination (R^2, 0 when y is constant)
+sub linear_fit {
+   my ($xs, $ys) = @_;
+   my $n = scalar (@{ $xs });
+   my ($sx, $sy) = (0, 0);
+
+   for (my $i = 0; $i < $n; $i++) {
+      $sx += $xs->[$i];
+      $sy += $ys->[$i];
+   }
+   my $mx = $sx / $n;
+   my $my = $sy / $n;
+
+   my ($sxx, $syy, $sxy) = (0, 0, 0);
+   for (my $i = 0; $i < $n; $i++) {
+      my $dx = $xs->[$i] - $mx;
+      my $dy = $ys->[$i] - $my;
+      $sxx += $dx * $dx;
+      $syy += $dy * $dy;
+      $sxy += $dx * $dy;
+   }
+   return (0, 0) if (($sxx == 0) || ($syy == 0));
+   return ($sxy / $sxx, ($sxy * $sxy) / ($sxx * $syy));
 }
 
-my $idx = 1;
-foreach my $ptr (keys %chunks) {
-    my $thread_id = $chunks{$ptr}{'thread_id'};
+if (($trend_window > 0) && (scalar (@trend_samples) >= $trend_min_windows)) {
+   my @xs = map { ($_->{'ts'} - $ts_min) / 1000000 } @trend_samples;
+   my $half = int (scalar (@xs) / 2);
+   my %seen;
+   my @suspects;
 
-    if(!defined($chunks{$ptr}{'size'})) {
-       print "warn: $ptr does not have size!\n";
-    }
+   foreach my $sample (@trend_samples) {
+      $seen{$_} = 1 foreach (keys %{ $sample->{'callsites'} });
+   }
 
-    if ($show_all) {
-        print "\nblock #" . $idx . ": block of " . $chunks{$ptr}{'size'} . " bytes not freed\n";
-        print "\taddress  : " . $ptr . "\n";
-        print "\ttimestamp: " . $chunks{$ptr}{'timestamp'} . "\n";
-        print "\tthread   : " . $thread_id . "\n";
-        print "\tcallstack:\n";
-    }
+   foreach my $btstr (keys %seen) {
+      my @ys = map { $_->{'callsites'}{$btstr} || 0 } @trend_samples;
+      my ($slope, $r2) = linear_fit (\@xs, \@ys);
+      next if (($slope <= 0) || ($r2 < $trend_min_r2));
 
-    my $btstr = $chunks{$ptr}{'backtrace'};
-    my @bt = split (/\;/, $btstr);
-    if ($show_all) {
-       foreach $a (@bt) {
-           my %result = decode ($a);
-           print "\t\t" . $result{'loc'} . "\n";
-       }
-    }
-    $idx = $idx + 1;
-}
+      # Caches grow and then plateau: check that growth goes on over
+      # the second half of the windows
+      my @xs2 = @xs[$half .. $#xs];
+      my @ys2 = @ys[$half .. $#ys];
+      my ($recent) = linear_fit (\@xs2, \@ys2);
 
-print "\n";
-print "Current heap utilization by modules:\n";
-print "------------------------------------\n";
-print "\n";
+      push (@suspects, {
+         'btstr'  => $btstr,
+         'slope'  => $slope,
+         'r2'     => $r2,
+         'recent' => $recent,
+         'first'  => $ys[0],
+         'last'   => $ys[-1],
+      });
+   }
 
-foreach my $obj (keys %usage_by_objects) {
-   my $sz = $usage_by_objects{$obj};
-   printf ("%-40s %24u (%3d%%)\n", basename ($obj), $sz, ($sz * 100) / $total);
+   my @leaks_all = grep { $_->{'recent'} >= $_->{'slope'} / 2 } @suspects;
+   my @leaks = sort { $b->{'slope'} <=> $a->{'slope'} } @leaks_all;
+   splice (@leaks, $top_count) if (scalar (@leaks) > $top_count);
+
+   foreach my $l (@leaks) {
+      collect_addresses ($l->{'btstr'});
+   }
+   decode_pending ();
+
+   print "\n";
+   print "Callsites with steadily growing live bytes:\n";
+   print "-------------------------------------------\n";
+   print "\n";
+   my $fmt = "%u windows of %ss, %u of %u growing callsites still growing over the last %u windows\n";
+   printf ($fmt, scalar (@trend_samples), $trend_window, scalar (@leaks_all), scalar (@suspects), scalar (@xs) - $half);
+
+   foreach my $l (@leaks) {
+      my ($rate, $unit) = B_max_label ($l->{'slope'});
+      $rate =~ s/^ +//;
+      print "\n";
+      print "+" . $rate . $unit . "/s (R2 " . sprintf ("%.2f", $l->{'r2'}) . "), " .
+         $l->{'first'} . " -> " . $l->{'last'} . " bytes from:\n";
+      foreach my $loc (callsite_locs ($l->{'btstr'})) {
+         print "\t\t" . $loc . "\n";
+      }
+   }
 }
-printf ("%-40s %24u (100%%)\n", "TOTAL", $total);
 
-print "\n";
-print "Current heap utilization by threads:\n";
-print "------------------------------------\n";
-print "\n";
+#----------------------------------------------------------------------------
+# Folded stacks (--folded)
+#----------------------------------------------------------------------------
 
-foreach my $thr (keys %usage_by_threads) {
-   my $sz = $usage_by_threads{$thr};
-   printf ("%-40s %24u (%3d%%)\n", "thread " . $thr, $sz, ($sz * 100) / $total);
+# Name of a frame in folded stacks: its function or, if unknown, its
+# address and object
+sub folded_frame {
+   my %result = decode ($_[0]);
+   my $name = $result{'method'};
+
+   if (($name eq '') || ($name eq '???')) {
+      $name = "0x" . $_[0];
+      $name .= " [" . basename ($result{'object'}) . "]" if ($result{'object'} ne 'unknown');
+   }
+   $name =~ s/;/:/g;
+   return $name;
 }
-printf ("%-40s %24u (100%%)\n", "TOTAL", $total);
 
-if ($show_grouped) {
+if ($folded ne '') {
+   my %weights;
+   my %stacks;
 
-    if ($live_report ne '') {
-       open (REPORT, '>', $live_report);
-    }
+   foreach my $btstr (keys %hotspots) {
+      my $h = $hotspots{$btstr};
+      my $weight;
 
-    print "\n";
-    print "Allocated blocks grouped by callstacks:\n";
-    print "---------------------------------------\n";
+      if    ($folded_weight eq 'live')        { $weight = $h->{'size'}; }
+      elsif ($folded_weight eq 'alloc-bytes') { $weight = $h->{'bytes'} || 0; }
+      elsif ($folded_weight eq 'allocs')      { $weight = $h->{'allocs'}; }
+      else                                    { $weight = ($h->{'bytes'} || 0) - $h->{'size'}; }
 
-    foreach my $btstr (sort {$hotspots{$b}{'size'} <=> $hotspots{$a}{'size'} } keys %hotspots) {
-        next if ($hotspots{$btstr}{'size'} == 0);
-        my $allocs = $hotspots{$btstr}{'allocs'};
-        my $frees  = $hotspots{$btstr}{'frees'};
-        my $size   = $hotspots{$btstr}{'size'};
-        my $total  = $allocs + $frees;
-        my $ratio  = floor ($allocs * 100 / $total);
-        print "\n";
-        print $allocs . " allocation(s) ($ratio% alive) for a total of " . 
-            $size . " bytes from:\n";
-        my @bt = split (/\;/, $btstr);
-        foreach my $a (@bt) {
-            my %result = decode ($a);
-            print "\t\t" . $result{'loc'} . "\n";
-        }
-        if ($live_report ne '') {
-           my %result = get_caller_info ($btstr);
-	   if (%result) {
-              my $obj    = $result{'object'};
-              my $loc    = $result{'loc'};
-              my $dir    = $result{'dir'};
-              my $file   = $result{'file'};
-              my $line   = $result{'line'};
-              my $method = $result{'method'};
-              print REPORT "$obj;$dir;$file;$line;$method;$allocs;$frees;$size\n";
-           }
-        }
-    }
-    if ($live_report ne '') {
-       close (REPORT);
-    }
+      next if ($weight <= 0);
+      $weights{$btstr} = $weight;
+      collect_addresses ($btstr);
+   }
+   decode_pending ();
+
+   # Root frame first, stacks decoded to the same functions are merged
+   foreach my $btstr (keys %weights) {
+      my @bt = split (/\;/, $btstr);
+      my $stack = join (';', map { folded_frame ($_) } reverse (@bt));
+      $stack = '[unknown]' if ($stack eq '');
+      $stacks{$stack} += $weights{$btstr};
+   }
+
+   open (FOLDED, ">" . $folded) or die("Could not create " . $folded . "!");
+   foreach my $stack (sort keys %stacks) {
+      print FOLDED $stack . " " . $stacks{$stack} . "\n";
+   }
+   close (FOLDED);
+   print "\n";
+   print "# " . scalar (keys %stacks) . " folded stacks (" . $folded_weight . ") written to '" . $folded . "'\n";
 }
 
 #----------------------------------------------------------------------------
-# Dump unknown frees
+# pprof profile (--pprof)
 #----------------------------------------------------------------------------
 
-if (($show_unknown) && (scalar (keys %unknown_frees) > 0)) {
+# Protocol buffers encoding of the few types used by profile.proto
 
-    print "\n";
-    print "Free operations without a matching allocation:\n";
-    print "----------------------------------------------\n";
+sub pb_varint {
+   my $value = $_[0];
+   my $result = '';
 
-    foreach my $btstr (sort {$unknown_frees{$b} <=> $unknown_frees{$a}} keys %unknown_frees) {
-       print "\n";
-       print $unknown_frees{$btstr} . " free(s) from:\n";
-       my @bt = split (/\;/, $btstr);
-       foreach my $a (@bt) {
-          my %result = decode ($a);
-          print "\t\t" . $result{'loc'} . "\n";
-       }
+   # Negative values are encoded as 64-bit two's complement
+   $value = unpack ('Q', pack ('q', $value)) if ($value < 0);
+
+   while ($value >= 0x80) {
+      $result .= chr (($value & 0x7f) | 0x80);
+      $value >>= 7;
+   }
+   return $result . chr ($value);
+}
+
+# Field holding a varint (0 values are the default and are omitted)
+sub pb_int {
+   my ($field, $value) = @_;
+   return '' if ($value == 0);
+   return pb_varint ($field << 3) . pb_varint ($value);
+}
+
+# Length-delimited field (strings and messages)
+sub pb_bytes {
+   my ($field, $data) = @_;
+   return pb_varint (($field << 3) | 2) . pb_varint (length ($data)) . $data;
+}
+
+# Packed repeated varints
+sub pb_packed {
+   my ($field, @values) = @_;
+   return pb_bytes ($field, join ('', map { pb_varint ($_) } @values));
+}
+
+if ($pprof ne '') {
+   my @strings = ('');
+   my %string_ids = ('' => 0);
+   my $str = sub {
+      my $s = $_[0];
+      if (!defined ($string_ids{$s})) {
+         $string_ids{$s} = scalar (@strings);
+         push (@strings, $s);
+      }
+      return $string_ids{$s};
+   };
+
+   foreach my $btstr (keys %hotspots) {
+      collect_addresses ($btstr);
+   }
+   decode_pending ();
+
+   # Sample types, in the order of the sample values
+   my $profile = '';
+   foreach my $type (['alloc_objects', 'count'], ['alloc_space', 'bytes'],
+                     ['inuse_objects', 'count'], ['inuse_space', 'bytes']) {
+      $profile .= pb_bytes (1, pb_int (1, $str->($type->[0])) . pb_int (2, $str->($type->[1])));
+   }
+
+   # Mappings of the executable regions from the map file, one per region
+   # (objects may have several)
+   my %has_lines;
+   foreach my $a (keys %hsyms) {
+      $has_lines{$hsyms{$a}{'object'}} = 1 if ($hsyms{$a}{'file'} ne '');
    }
+   for (my $i = 0; $i < scalar (@maps_index); $i++) {
+      my $m = $maps_index[$i];
+      my $obj = $m->{'file'};
+
+      object_elf ($obj);
+      my $symbols = $has_lines{$obj} || 0;
+      $profile .= pb_bytes (3, pb_int (1, $i + 1) .
+                               pb_int (2, $m->{'start'}) .
+                               pb_int (3, $m->{'end'}) .
+                               pb_int (4, $m->{'pgoff'}) .
+                               pb_int (5, $str->($obj)) .
+                               pb_int (6, $str->($objects{$obj}{'build_id'})) .
+                               pb_int (7, $symbols) .
+                               pb_int (8, $symbols) .
+                               pb_int (9, $symbols));
+   }
+
+   # Samples (one per callsite) and their locations, leaf first
+   my %location_ids;
+   my %function_ids;
+   my $locations = '';
+   my $functions = '';
+   foreach my $btstr (sort keys %hotspots) {
+      my $h = $hotspots{$btstr};
+      my @ids;
+
+      foreach my $a (split (/\;/, $btstr)) {
+         if (!defined ($location_ids{$a})) {
+            my $id = $location_ids{$a} = scalar (keys %location_ids) + 1;
+            my %result = decode ($a);
+            my $mapping = ($a =~ /^[0-9a-f]+$/) ? map_entry_from_addr (hex ($a)) + 1 : 0;
+            my $line = '';
+
+            if (($result{'method'} ne '') && ($result{'method'} ne '???')) {
+               my $path = ($result{'file'} ne '') ? $result{'dir'} . "/" . $result{'file'} : '';
+               my $key = $result{'method'} . "\t" . $path;
+               if (!defined ($function_ids{$key})) {
+                  $function_ids{$key} = scalar (keys %function_ids) + 1;
+                  $functions .= pb_bytes (5, pb_int (1, $function_ids{$key}) .
+                                             pb_int (2, $str->($result{'method'})) .
+                                             pb_int (3, $str->($result{'method'})) .
+                                             pb_int (4, $str->($path)));
+               }
+               $line = pb_bytes (4, pb_int (1, $function_ids{$key}) . pb_int (2, $result{'line'} || 0));
+            }
+            $locations .= pb_bytes (4, pb_int (1, $id) .
+                                       pb_int (2, $mapping) .
+                                       pb_int (3, hex ($a)) . $line);
+         }
+         push (@ids, $location_ids{$a});
+      }
+
+      # Blocks freed but not seen allocated (log started mid-run or entries
+      # lost) may leave fewer allocations than frees
+      my $inuse = $h->{'allocs'} - $h->{'frees'};
+      $inuse = 0 if ($inuse < 0);
+      my @values = ($h->{'allocs'}, $h->{'bytes'} || 0, $inuse, $h->{'size'});
+      $profile .= pb_bytes (2, pb_packed (1, @ids) . pb_packed (2, @values));
+   }
+   $profile .= $locations . $functions;
+
+   # Period type must be interned before writing the string table
+   my $period_type = pb_int (1, $str->('space')) . pb_int (2, $str->('bytes'));
+   my $default_type = $str->('inuse_space');
+   foreach my $s (@strings) {
+      $profile .= pb_bytes (6, $s);
+   }
+   $profile .= pb_int (9, $ts_min * 1000) .
+               pb_int (10, ($ts_max - $ts_min) * 1000) .
+               pb_bytes (11, $period_type) .
+               pb_int (12, 1) .
+               pb_int (14, $default_type);
+
+   gzip (\$profile => $pprof) or die("Could not create " . $pprof . ": " . $GzipError);
+   print "\n";
+   print "# pprof profile (" . scalar (keys %hotspots) . " samples) written to '" . $pprof . "'\n";
 }
 
 #----------------------------------------------------------------------------
@@ -971,3 +4511,7 @@ if ($graph ne '') {
    close (GRAPH);
 }
 
+# Save the symbols decoded during this run for the next ones
+if ($symbol_cache ne '') {
+   symbol_cache_store ();
+}
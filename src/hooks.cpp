@@ -22,8 +22,12 @@
 #define TRACE_CLASS_DEFAULT HOOKS
 #include "internal.h"
 
+#include <errno.h>
 #include <new>
-#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
 
 #ifdef malloc
 #undef malloc
@@ -51,11 +55,7 @@ calloc (size_t n, size_t size) {
 
    TRACE3 (("called with n=%u, size=%u", n, size));
 
-   size = size * n;
-   result = do_malloc (size, 0);
-   if (result != 0) {
-      memset (result, 0, size);
-   }
+   result = do_calloc (n, size, 0);
 
    TRACE3 (("exiting with result=%p", result));
    return result;
@@ -104,6 +104,177 @@ free (void* p) {
    TRACE3 (("exiting"));
 }
 
+void *
+memalign (size_t alignment, size_t s) {
+   void *result;
+
+   TRACE3 (("called with alignment=%u, s=%u", alignment, s));
+
+   result = do_memalign (alignment, s, 0);
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+void *
+aligned_alloc (size_t alignment, size_t s) {
+   void *result;
+
+   TRACE3 (("called with alignment=%u, s=%u", alignment, s));
+
+   result = do_memalign (alignment, s, 0);
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+int
+posix_memalign (void **memptr, size_t alignment, size_t s) {
+   int result;
+   int saved_errno = errno;
+
+   TRACE3 (("called with memptr=%p, alignment=%u, s=%u", memptr, alignment, s));
+
+   /* The alignment shall be a power of two multiple of sizeof (void *). */
+   if ((alignment == 0) || ((alignment % sizeof (void *)) != 0) ||
+       ((alignment & (alignment - 1)) != 0)) {
+      result = EINVAL;
+   }
+   else {
+      void *p = do_memalign (alignment, s, 0);
+      if (p != 0) {
+         *memptr = p;
+         result = 0;
+      }
+      else {
+         result = ENOMEM;
+      }
+   }
+
+   /* posix_memalign() does not set errno. */
+   errno = saved_errno;
+
+   TRACE3 (("exiting with result=%d", result));
+   return result;
+}
+
+void *
+valloc (size_t s) {
+   void *result;
+
+   TRACE3 (("called with s=%u", s));
+
+   result = do_memalign (sysconf (_SC_PAGESIZE), s, 0);
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+void *
+pvalloc (size_t s) {
+   void *result;
+   size_t page = sysconf (_SC_PAGESIZE);
+
+   TRACE3 (("called with s=%u", s));
+
+   /* Round the size up to whole pages (one page for 0). */
+   if (s > ((size_t) -1) - page) {
+      errno = ENOMEM;
+      result = 0;
+   }
+   else {
+      s = (s == 0) ? page : (s + page - 1) & ~(page - 1);
+      result = do_memalign (page, s, 0);
+   }
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+void *
+mmap (void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+   void *result;
+
+   TRACE3 (("called with addr=%p, len=%u, prot=%x, flags=%x, fd=%d",
+      addr, len, prot, flags, fd));
+
+   result = do_mmap (addr, len, prot, flags, fd, offset, 0);
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+void *
+mmap64 (void *addr, size_t len, int prot, int flags, int fd, off64_t offset) {
+   void *result;
+
+   TRACE3 (("called with addr=%p, len=%u, prot=%x, flags=%x, fd=%d",
+      addr, len, prot, flags, fd));
+
+   result = do_mmap (addr, len, prot, flags, fd, offset, 0);
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+int
+munmap (void *addr, size_t len) {
+   int result;
+
+   TRACE3 (("called with addr=%p, len=%u", addr, len));
+
+   result = do_munmap (addr, len, 0);
+
+   TRACE3 (("exiting with result=%d", result));
+   return result;
+}
+
+void *
+mremap (void *addr, size_t old_len, size_t new_len, int flags, ...) {
+   void *result;
+   void *new_addr = 0;
+
+   TRACE3 (("called with addr=%p, old_len=%u, new_len=%u, flags=%x",
+      addr, old_len, new_len, flags));
+
+   /* The new address is only passed along with MREMAP_FIXED. */
+   if (flags & MREMAP_FIXED) {
+      va_list args;
+      va_start (args, flags);
+      new_addr = va_arg (args, void *);
+      va_end (args);
+   }
+
+   result = do_mremap (addr, old_len, new_len, flags, new_addr, 0);
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+void *
+sbrk (intptr_t increment) {
+   void *result;
+
+   TRACE3 (("called with increment=%d", (int) increment));
+
+   result = do_sbrk (increment, 0);
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+int
+brk (void *addr) {
+   int result;
+
+   TRACE3 (("called with addr=%p", addr));
+
+   result = do_brk (addr, 0);
+
+   TRACE3 (("exiting with result=%d", result));
+   return result;
+}
+
 void *
 operator new (size_t size) {
 
@@ -181,3 +352,119 @@ operator delete[] (void *ptr, const std::nothrow_t&) {
    TRACE3 (("exiting"));
 }
  
+
+#ifdef __cpp_sized_deallocation
+
+void
+operator delete (void *ptr, std::size_t size) {
+   TRACE3 (("called with ptr=%p, size=%u", ptr, size));
+   do_free_sized (ptr, size, 0);
+   TRACE3 (("exiting"));
+}
+
+void
+operator delete[] (void *ptr, std::size_t size) {
+   TRACE3 (("called with ptr=%p, size=%u", ptr, size));
+   do_free_sized (ptr, size, 0);
+   TRACE3 (("exiting"));
+}
+
+#endif /* __cpp_sized_deallocation */
+
+#ifdef __cpp_aligned_new
+
+void *
+operator new (std::size_t size, std::align_val_t alignment) {
+
+   void *result;
+   TRACE3 (("called with size=%u, alignment=%u", size, alignment));
+
+   result = do_memalign (static_cast<std::size_t> (alignment), size, 0);
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+void *
+operator new[] (std::size_t size, std::align_val_t alignment) {
+
+   void *result;
+   TRACE3 (("called with size=%u, alignment=%u", size, alignment));
+
+   result = do_memalign (static_cast<std::size_t> (alignment), size, 0);
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+void *
+operator new (std::size_t size, std::align_val_t alignment, std::nothrow_t const&) {
+
+   void *result;
+   TRACE3 (("called with size=%u, alignment=%u", size, alignment));
+
+   result = do_memalign (static_cast<std::size_t> (alignment), size, 0);
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+void *
+operator new[] (std::size_t size, std::align_val_t alignment, std::nothrow_t const&) {
+
+   void *result;
+   TRACE3 (("called with size=%u, alignment=%u", size, alignment));
+
+   result = do_memalign (static_cast<std::size_t> (alignment), size, 0);
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+void
+operator delete (void *ptr, std::align_val_t) {
+   TRACE3 (("called with ptr=%p", ptr));
+   do_free (ptr, 0);
+   TRACE3 (("exiting"));
+}
+
+void
+operator delete[] (void *ptr, std::align_val_t) {
+   TRACE3 (("called with ptr=%p", ptr));
+   do_free (ptr, 0);
+   TRACE3 (("exiting"));
+}
+
+void
+operator delete (void *ptr, std::align_val_t, std::nothrow_t const&) {
+   TRACE3 (("called with ptr=%p", ptr));
+   do_free (ptr, 0);
+   TRACE3 (("exiting"));
+}
+
+void
+operator delete[] (void *ptr, std::align_val_t, std::nothrow_t const&) {
+   TRACE3 (("called with ptr=%p", ptr));
+   do_free (ptr, 0);
+   TRACE3 (("exiting"));
+}
+
+#ifdef __cpp_sized_deallocation
+
+void
+operator delete (void *ptr, std::size_t size, std::align_val_t) {
+   TRACE3 (("called with ptr=%p, size=%u", ptr, size));
+   do_free_sized (ptr, size, 0);
+   TRACE3 (("exiting"));
+}
+
+void
+operator delete[] (void *ptr, std::size_t size, std::align_val_t) {
+   TRACE3 (("called with ptr=%p, size=%u", ptr, size));
+   do_free_sized (ptr, size, 0);
+   TRACE3 (("exiting"));
+}
+
+#endif /* __cpp_sized_deallocation */
+
+#endif /* __cpp_aligned_new */
@@ -30,6 +30,8 @@
 
 #include <memtraq.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #define  TRACE_ENV_PREFIX "MEMTRAQ_TRACE_"
 #define  TRACE_TRC_FILE   "memtraq.trc"
@@ -62,15 +64,54 @@ realloc (void* ptr, size_t newsize) __attribute__((visibility("default")));
 extern void*
 calloc (size_t n, size_t size) __attribute__((visibility("default")));
 
+extern void*
+memalign (size_t alignment, size_t size) __attribute__((visibility("default")));
+
+extern void*
+aligned_alloc (size_t alignment, size_t size) __attribute__((visibility("default")));
+
+extern int
+posix_memalign (void** memptr, size_t alignment, size_t size) __attribute__((visibility("default")));
+
+extern void*
+valloc (size_t size) __attribute__((visibility("default")));
+
+extern void*
+pvalloc (size_t size) __attribute__((visibility("default")));
+
 void*
 do_malloc (size_t s, int skip);
 
+void*
+do_calloc (size_t n, size_t s, int skip);
+
+void*
+do_memalign (size_t alignment, size_t s, int skip);
+
 void
 do_free (void* p, int skip);
 
+void
+do_free_sized (void* p, size_t s, int skip);
+
 void*
 do_realloc (void* p, size_t s, int skip);
 
+void*
+do_mmap (void* addr, size_t len, int prot, int flags, int fd, off64_t offset, int skip);
+
+int
+do_munmap (void* addr, size_t len, int skip);
+
+void*
+do_mremap (void* addr, size_t old_len, size_t new_len, int flags, void* new_addr, int skip);
+
+void*
+do_sbrk (intptr_t increment, int skip);
+
+int
+do_brk (void* addr, int skip);
+
 #ifdef __cplusplus
 }
 #endif
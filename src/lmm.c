@@ -155,6 +155,40 @@ lmm_alloc (size_t s) {
    return 0;
 }
 
+void*
+lmm_memalign (size_t alignment, size_t s) {
+   char* result;
+   char* aligned;
+   size_t a;
+
+   TRACE3 (("called with alignment=%u, s=%u", alignment, s));
+
+   /* Round the alignment up to a power of two. */
+   for (a = 1; a < alignment; a <<= 1);
+
+   /* Get enough memory for the block and a header in front of its aligned
+    * start. */
+   result = lmm_alloc (s + a + sizeof (clist_t));
+   if ((result != 0) && ((((unsigned long) result) & (a - 1)) != 0)) {
+      clist_t* head;
+      clist_t* it;
+
+      /* Give the memory before the aligned start back to the pool as a
+       * block of its own. */
+      aligned = (char*) ALIGN ((unsigned long) result + sizeof (clist_t), a);
+      head = ((clist_t*) result) - 1;
+      it = ((clist_t*) aligned) - 1;
+      it->size = head->size - (aligned - result);
+      it->marker = GOOD_MARKER;
+      head->size = (aligned - result) - sizeof (clist_t);
+      lmm_free (result);
+      result = aligned;
+   }
+
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
 void
 lmm_free (void *p) {
    clist_t *it;
@@ -29,6 +29,9 @@ extern "C" {
 extern void*
 lmm_alloc (size_t s);
 
+extern void*
+lmm_memalign (size_t alignment, size_t s);
+
 extern void
 lmm_free (void *p);
 
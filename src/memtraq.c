@@ -24,6 +24,7 @@
 
 #include <assert.h>
 #include <dlfcn.h>
+#include <errno.h>
 #include <execinfo.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -32,9 +33,11 @@
 
 #include <netinet/in.h>
 
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 
 typedef enum {
    false = 0,
@@ -46,9 +49,38 @@ typedef enum {
    MALLOC = 1,
    FREE = 2,
    REALLOC = 3,
-   TAG = 4
+   TAG = 4,
+   MMAP = 5,
+   MUNMAP = 6,
+   MREMAP = 7,
+   SBRK = 8,
+   BRK = 9,
+   CALLOC = 10,
+   MEMALIGN = 11,
+   FREE_SIZED = 12,
+   CONTEXT = 13
 } ev_t;
 
+/** Flags of the INIT event describing the optional fields of the log. */
+typedef enum {
+   INIT_FLAG_LATENCY = 0x1,
+   INIT_FLAG_CONTEXT = 0x2
+} init_flags_t;
+
+/** Maximum depth of the per-thread stacks of contexts. */
+#define MAX_CONTEXT_DEPTH 16
+
+/** Maximum length of the context labels (longer labels are truncated). */
+#define MAX_CONTEXT_LABEL 256
+
+/** Stack of contexts pushed by a thread with memtraq_context_push(). Deeper
+  * contexts are counted but allocations are accounted to the deepest one
+  * that was recorded. */
+typedef struct {
+   unsigned int depth;
+   unsigned int ids [MAX_CONTEXT_DEPTH];
+} context_stack_t;
+
 /** Boolean for checking whether memtraq has initialized itself. */
 static bool initialized = false;
 
@@ -58,15 +90,28 @@ static bool enabled = false;
 /** Boolean for backtrace to be emitted for free() (defaults to false). */
 static bool backtrace_free = false;
 
+/** Boolean for timing calls to the C library allocator (defaults to false). */
+static bool latency = false;
+
+/** Boolean for stamping allocations with the context of the calling thread
+  * (defaults to false). */
+static bool contexts = false;
+
 /** Serial number for tags created with memtraq_tag(). */
 static unsigned int tag_serial = 0;
 
+/** Identifier of the last context created with memtraq_context_push(). */
+static unsigned int context_serial = 0;
+
 /** Lock for serializing memory requests. */
 static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /** TLS to detect recursion in malloc/free/realloc operations. */
 static pthread_key_t nested_level_key;
 
+/** TLS for the stack of contexts of the calling thread. */
+static pthread_key_t context_key;
+
 /** File to log transactions to (set on initialization from the MEMTRAQ_LOG
   * environment variable). */
 static FILE *logf;
@@ -78,9 +123,19 @@ static struct sockaddr_in ra;
 #define LOG_HEADER_SIZE 12
 
 extern void *__libc_malloc  (size_t);
+extern void *__libc_calloc  (size_t, size_t);
+extern void *__libc_memalign (size_t, size_t);
 extern void  __libc_free    (void *);
 extern void *__libc_realloc (void *, size_t);
 
+/* Wrappers of the C library for the mapping and break system calls (these
+ * have no exported __libc_ aliases and are looked up on initialization). */
+static void *(*libc_mmap64) (void *, size_t, int, int, int, off64_t);
+static int   (*libc_munmap) (void *, size_t);
+static void *(*libc_mremap) (void *, size_t, size_t, int, ...);
+static void *(*libc_sbrk)   (intptr_t);
+static int   (*libc_brk)    (void *);
+
 #define DEFAULT_DST_PORT 6001
 #define DEFAULT_SRC_PORT 8000
 
@@ -122,6 +177,18 @@ log_str (char *buffer, const char *str) {
    return buffer;
 }
 
+static char *
+log_strn (char *buffer, const char *str, size_t max) {
+
+   size_t sz;
+
+   sz = strnlen (str, max);
+   memcpy (buffer, str, sz);
+   buffer += sz;
+
+   return buffer;
+}
+
 static char *
 log_event (char *buffer, ev_t event) {
 
@@ -143,6 +210,72 @@ log_event (char *buffer, ev_t event) {
    return buffer;
 }
 
+/**
+  * Get a monotonic time in nanoseconds for measuring the duration of
+  * calls to the C library allocator.
+  *
+  */
+static unsigned long long
+now_ns (void) {
+
+   struct timespec ts;
+
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return (ts.tv_sec * 1000000000ULL) + (unsigned long long) ts.tv_nsec;
+}
+
+/**
+  * Get the time elapsed since start (as returned by now_ns()), saturated
+  * to fit in 32 bits.
+  *
+  */
+static unsigned int
+elapsed_ns (unsigned long long start) {
+
+   unsigned long long elapsed;
+
+   elapsed = now_ns () - start;
+   if (elapsed > 0xffffffffULL) {
+      elapsed = 0xffffffffULL;
+   }
+   return (unsigned int) elapsed;
+}
+
+/**
+  * Free the stack of contexts of an exiting thread.
+  *
+  */
+static void
+context_free (void *stack) {
+   lmm_free (stack);
+}
+
+/**
+  * Get the context of the calling thread.
+  *
+  * @return the identifier of the innermost context pushed by the calling
+  * thread (0 if none).
+  *
+  */
+static unsigned int
+current_context (void) {
+
+   context_stack_t *stack;
+   unsigned int result = 0;
+
+   stack = pthread_getspecific (context_key);
+   if ((stack != 0) && (stack->depth > 0)) {
+      if (stack->depth > MAX_CONTEXT_DEPTH) {
+         result = stack->ids [MAX_CONTEXT_DEPTH - 1];
+      }
+      else {
+         result = stack->ids [stack->depth - 1];
+      }
+   }
+
+   return result;
+}
+
 static void
 log_write (char *buffer) {
 
@@ -167,16 +300,26 @@ do_init (void) {
    FILE *f;
    const char *fn;
    const char *backtrace_free_value;
+   const char *context_value;
+   const char *latency_value;
    const char *tgt_value;
    bool result = true;
 
    /* Create TLS and set level to 1. */
    (void) pthread_key_create (&nested_level_key, NULL);
    pthread_setspecific (nested_level_key, (void *) 1);
+   (void) pthread_key_create (&context_key, context_free);
 
    /* Initialize tracing. */
    trace_init ();
 
+   /* Look up the C library functions wrapped by the mmap/brk hooks. */
+   libc_mmap64 = dlsym (RTLD_NEXT, "mmap64");
+   libc_munmap = dlsym (RTLD_NEXT, "munmap");
+   libc_mremap = dlsym (RTLD_NEXT, "mremap");
+   libc_sbrk   = dlsym (RTLD_NEXT, "sbrk");
+   libc_brk    = dlsym (RTLD_NEXT, "brk");
+
    fn = getenv ("MEMTRAQ_LOG");
    if (fn != 0) {
       f = fopen (fn, "w");
@@ -222,6 +365,28 @@ do_init (void) {
       }
    }
 
+   /* Check whether to time calls to the C library allocator. */
+   latency_value = getenv ("MEMTRAQ_LATENCY");
+   if (latency_value != 0) {
+      if (strcmp (latency_value, "0") == 0) {
+         latency = false;
+      }
+      else {
+         latency = true;
+      }
+   }
+
+   /* Check whether to stamp allocations with contexts. */
+   context_value = getenv ("MEMTRAQ_CONTEXT");
+   if (context_value != 0) {
+      if (strcmp (context_value, "0") == 0) {
+         contexts = false;
+      }
+      else {
+         contexts = true;
+      }
+   }
+
    TRACE3 (("exiting with result=%d", result));
    pthread_setspecific (nested_level_key, (void *) 0);
    return result;
@@ -253,6 +418,9 @@ check_initialized (void) {
          buffer = log_buffer + LOG_HEADER_SIZE;
          buffer = log_event (buffer, INIT);
          buffer = log_u32 (buffer, enabled);
+         buffer = log_u32 (buffer,
+            ((latency == true) ? INIT_FLAG_LATENCY : 0) |
+            ((contexts == true) ? INIT_FLAG_CONTEXT : 0));
          log_write (buffer);
 
          pthread_mutex_unlock (&log_lock);
@@ -325,8 +493,16 @@ do_malloc (size_t s, int skip) {
    else {
 
       if (check_initialized ()) {
+         unsigned long long start = 0;
+         unsigned int duration = 0;
 
+         if (latency == true) {
+            start = now_ns ();
+         }
          result = __libc_malloc (s);
+         if (latency == true) {
+            duration = elapsed_ns (start);
+         }
 
          /* Check if logging is enabled. */
          pthread_mutex_lock (&log_lock);
@@ -345,6 +521,12 @@ do_malloc (size_t s, int skip) {
             buffer = log_event (buffer, MALLOC);
             buffer = log_u32 (buffer, s);
             buffer = log_ptr (buffer, result);
+            if (latency == true) {
+               buffer = log_u32 (buffer, duration);
+            }
+            if (contexts == true) {
+               buffer = log_u32 (buffer, current_context ());
+            }
             for (i = (skip + 1); i < n; i++) {
                buffer = log_ptr (buffer, bt [i]);
             }
@@ -362,30 +544,188 @@ do_malloc (size_t s, int skip) {
    return result;
 }
 
-void
-do_free (void *p, int skip) {
+void *
+do_calloc (size_t n, size_t s, int skip) {
 
    unsigned int nested_level;
+   void* result;
+
+   TRACE3 (("called with n=%u, s=%u, skip=%d", n, s, skip));
+
+   /* Reject requests whose total size overflows size_t. */
+   if ((n != 0) && (s > ((size_t) -1) / n)) {
+      errno = ENOMEM;
+      TRACE3 (("exiting with result=0 (overflow)"));
+      return 0;
+   }
+
+   /* Requests made while a memory operation is in progress are served by
+    * the internal pool (see do_malloc()), which does not clear blocks. */
+   nested_level = enter ();
+   if (nested_level > 1) {
+      result = lmm_alloc (n * s);
+      if (result != 0) {
+         memset (result, 0, n * s);
+      }
+   }
+   else {
+
+      if (check_initialized ()) {
+         unsigned long long start = 0;
+         unsigned int duration = 0;
+
+         if (latency == true) {
+            start = now_ns ();
+         }
+         result = __libc_calloc (n, s);
+         if (latency == true) {
+            duration = elapsed_ns (start);
+         }
+
+         /* Check if logging is enabled. */
+         pthread_mutex_lock (&log_lock);
+         if (enabled) {
+            int   i,n_bt;
+            char *buffer;
+            void *bt [MAX_BT];
+
+            /* Get backtrace */
+            pthread_mutex_unlock (&log_lock);
+            n_bt = backtrace (bt, MAX_BT);
+            pthread_mutex_lock (&log_lock);
+
+            /* Log operation and backtrace. */
+            buffer = log_buffer + LOG_HEADER_SIZE;
+            buffer = log_event (buffer, CALLOC);
+            buffer = log_u32 (buffer, n);
+            buffer = log_u32 (buffer, s);
+            buffer = log_ptr (buffer, result);
+            if (latency == true) {
+               buffer = log_u32 (buffer, duration);
+            }
+            if (contexts == true) {
+               buffer = log_u32 (buffer, current_context ());
+            }
+            for (i = (skip + 1); i < n_bt; i++) {
+               buffer = log_ptr (buffer, bt [i]);
+            }
+            log_write (buffer);
+         }
+         pthread_mutex_unlock (&log_lock);
+      }
+      else {
+         result = 0;
+      }
+   }
+
+   leave ();
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+void *
+do_memalign (size_t alignment, size_t s, int skip) {
+
+   unsigned int nested_level;
+   void* result;
+
+   TRACE3 (("called with alignment=%u, s=%u, skip=%d", alignment, s, skip));
+
+   /* Requests made while a memory operation is in progress are served by
+    * the internal pool (see do_malloc()). */
+   nested_level = enter ();
+   if (nested_level > 1) {
+      result = lmm_memalign (alignment, s);
+   }
+   else {
+
+      if (check_initialized ()) {
+         unsigned long long start = 0;
+         unsigned int duration = 0;
+
+         if (latency == true) {
+            start = now_ns ();
+         }
+         result = __libc_memalign (alignment, s);
+         if (latency == true) {
+            duration = elapsed_ns (start);
+         }
+
+         /* Check if logging is enabled. */
+         pthread_mutex_lock (&log_lock);
+         if (enabled) {
+            int   i,n;
+            char *buffer;
+            void *bt [MAX_BT];
+
+            /* Get backtrace */
+            pthread_mutex_unlock (&log_lock);
+            n = backtrace (bt, MAX_BT);
+            pthread_mutex_lock (&log_lock);
+
+            /* Log operation and backtrace. */
+            buffer = log_buffer + LOG_HEADER_SIZE;
+            buffer = log_event (buffer, MEMALIGN);
+            buffer = log_u32 (buffer, alignment);
+            buffer = log_u32 (buffer, s);
+            buffer = log_ptr (buffer, result);
+            if (latency == true) {
+               buffer = log_u32 (buffer, duration);
+            }
+            if (contexts == true) {
+               buffer = log_u32 (buffer, current_context ());
+            }
+            for (i = (skip + 1); i < n; i++) {
+               buffer = log_ptr (buffer, bt [i]);
+            }
+            log_write (buffer);
+         }
+         pthread_mutex_unlock (&log_lock);
+      }
+      else {
+         result = 0;
+      }
+   }
+
+   leave ();
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+/** Release a block and log it as a FREE event, or as a FREE_SIZED event
+  * carrying the size given by the caller when sized is true. Always inlined
+  * so that do_free() and do_free_sized() skip the same number of frames. */
+static inline void
+free_block (void *p, size_t s, bool sized, int skip) __attribute__((always_inline));
+
+static inline void
+free_block (void *p, size_t s, bool sized, int skip) {
 
    /* Do not bother doing anything if called with a null pointer! */
    if (p == 0) {
       return;
    }
 
-   TRACE3 (("called with p=%p, skip=%d", p, skip));
-
-   nested_level = enter ();
+   enter ();
    if (lmm_valid (p)) {
       lmm_free (p);
    }
    else {
       if (check_initialized ()) {
+         unsigned long long start = 0;
+         unsigned int duration = 0;
 
+         if (latency == true) {
+            start = now_ns ();
+         }
          __libc_free (p);
+         if (latency == true) {
+            duration = elapsed_ns (start);
+         }
 
          pthread_mutex_lock (&log_lock);
          if (enabled) {
-            int   i,n;
+            int   i,n = 0;
             char *buffer;
             void *bt [MAX_BT];
 
@@ -396,15 +736,25 @@ do_free (void *p, int skip) {
                pthread_mutex_lock (&log_lock);
             }
 
-            /* Log operation and backtrace. */
+            /* Log operation (with the size given by the caller of a sized
+             * delete, to be checked against the one of the block) and
+             * backtrace. */
             buffer = log_buffer + LOG_HEADER_SIZE;
-            buffer = log_event (buffer, FREE);
-            buffer = log_ptr (buffer, p);
+            if (sized == true) {
+               buffer = log_event (buffer, FREE_SIZED);
+               buffer = log_ptr (buffer, p);
+               buffer = log_u32 (buffer, s);
+            }
+            else {
+               buffer = log_event (buffer, FREE);
+               buffer = log_ptr (buffer, p);
+            }
+            if (latency == true) {
+               buffer = log_u32 (buffer, duration);
+            }
 
-            if (backtrace_free == true) {
-               for (i = (skip + 1); i < n; i++) {
-                  buffer = log_ptr (buffer, bt [i]);
-               }
+            for (i = (skip + 1); i < n; i++) {
+               buffer = log_ptr (buffer, bt [i]);
             }
 
             log_write (buffer);
@@ -414,6 +764,21 @@ do_free (void *p, int skip) {
    }
 
    leave ();
+}
+
+void
+do_free (void *p, int skip) {
+
+   TRACE3 (("called with p=%p, skip=%d", p, skip));
+   free_block (p, 0, false, skip);
+   TRACE3 (("exit"));
+}
+
+void
+do_free_sized (void *p, size_t s, int skip) {
+
+   TRACE3 (("called with p=%p, s=%u, skip=%d", p, s, skip));
+   free_block (p, s, true, skip);
    TRACE3 (("exit"));
 }
 
@@ -432,8 +797,16 @@ do_realloc (void *p, size_t s, int skip) {
 
    nested_level = enter ();
    if (check_initialized () == true) {
+      unsigned long long start = 0;
+      unsigned int duration = 0;
 
+      if (latency == true) {
+         start = now_ns ();
+      }
       result = __libc_realloc (p, s);
+      if (latency == true) {
+         duration = elapsed_ns (start);
+      }
 
       pthread_mutex_lock (&log_lock);
       if (enabled) {
@@ -452,6 +825,12 @@ do_realloc (void *p, size_t s, int skip) {
          buffer = log_ptr (buffer, p);
          buffer = log_u32 (buffer, s);
          buffer = log_ptr (buffer, result);
+         if (latency == true) {
+            buffer = log_u32 (buffer, duration);
+         }
+         if (contexts == true) {
+            buffer = log_u32 (buffer, current_context ());
+         }
          for (i = (skip + 1); i < n; i++) {
             buffer = log_ptr (buffer, bt [i]);
          }
@@ -468,6 +847,283 @@ do_realloc (void *p, size_t s, int skip) {
    return result;
 }
 
+void *
+do_mmap (void *addr, size_t len, int prot, int flags, int fd, off64_t offset, int skip) {
+
+   unsigned int nested_level;
+   void *result;
+
+   TRACE3 (("called with addr=%p, len=%u, prot=%x, flags=%x, fd=%d, skip=%d",
+      addr, len, prot, flags, fd, skip));
+
+   /* Mappings created while memtraq is busy (e.g. by backtrace()) are not
+    * logged. */
+   nested_level = enter ();
+   if (libc_mmap64 == 0) {
+      errno = ENOSYS;
+      result = MAP_FAILED;
+   }
+   else if (nested_level > 1) {
+      result = libc_mmap64 (addr, len, prot, flags, fd, offset);
+   }
+   else {
+      result = libc_mmap64 (addr, len, prot, flags, fd, offset);
+      if (result != MAP_FAILED) {
+         int saved_errno = errno;
+
+         pthread_mutex_lock (&log_lock);
+         if (enabled) {
+            int   i,n;
+            char *buffer;
+            void *bt [MAX_BT];
+
+            /* Get backtrace */
+            pthread_mutex_unlock (&log_lock);
+            n = backtrace (bt, MAX_BT);
+            pthread_mutex_lock (&log_lock);
+
+            /* Log operation and backtrace (whether the mapping is anonymous
+             * is logged on its own since the value of MAP_ANONYMOUS differs
+             * from one architecture to another). */
+            buffer = log_buffer + LOG_HEADER_SIZE;
+            buffer = log_event (buffer, MMAP);
+            buffer = log_ptr (buffer, result);
+            buffer = log_u64 (buffer, len);
+            buffer = log_u32 (buffer, prot);
+            buffer = log_u32 (buffer, flags);
+            buffer = log_u32 (buffer, fd);
+            buffer = log_u32 (buffer, (flags & MAP_ANONYMOUS) != 0);
+            for (i = (skip + 1); i < n; i++) {
+               buffer = log_ptr (buffer, bt [i]);
+            }
+            log_write (buffer);
+         }
+         pthread_mutex_unlock (&log_lock);
+         errno = saved_errno;
+      }
+   }
+
+   leave ();
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+int
+do_munmap (void *addr, size_t len, int skip) {
+
+   unsigned int nested_level;
+   int result;
+
+   TRACE3 (("called with addr=%p, len=%u, skip=%d", addr, len, skip));
+
+   nested_level = enter ();
+   if (libc_munmap == 0) {
+      errno = ENOSYS;
+      result = -1;
+   }
+   else if (nested_level > 1) {
+      result = libc_munmap (addr, len);
+   }
+   else {
+      result = libc_munmap (addr, len);
+      if (result == 0) {
+         int saved_errno = errno;
+
+         pthread_mutex_lock (&log_lock);
+         if (enabled) {
+            int   i,n = 0;
+            char *buffer;
+            void *bt [MAX_BT];
+
+            /* Get backtrace */
+            if (backtrace_free == true) {
+               pthread_mutex_unlock (&log_lock);
+               n = backtrace (bt, MAX_BT);
+               pthread_mutex_lock (&log_lock);
+            }
+
+            /* Log operation and backtrace. */
+            buffer = log_buffer + LOG_HEADER_SIZE;
+            buffer = log_event (buffer, MUNMAP);
+            buffer = log_ptr (buffer, addr);
+            buffer = log_u64 (buffer, len);
+            if (backtrace_free == true) {
+               for (i = (skip + 1); i < n; i++) {
+                  buffer = log_ptr (buffer, bt [i]);
+               }
+            }
+            log_write (buffer);
+         }
+         pthread_mutex_unlock (&log_lock);
+         errno = saved_errno;
+      }
+   }
+
+   leave ();
+   TRACE3 (("exiting with result=%d", result));
+   return result;
+}
+
+void *
+do_mremap (void *addr, size_t old_len, size_t new_len, int flags, void *new_addr, int skip) {
+
+   unsigned int nested_level;
+   void *result;
+
+   TRACE3 (("called with addr=%p, old_len=%u, new_len=%u, flags=%x, skip=%d",
+      addr, old_len, new_len, flags, skip));
+
+   nested_level = enter ();
+   if (libc_mremap == 0) {
+      errno = ENOSYS;
+      result = MAP_FAILED;
+   }
+   else if (nested_level > 1) {
+      result = libc_mremap (addr, old_len, new_len, flags, new_addr);
+   }
+   else {
+      result = libc_mremap (addr, old_len, new_len, flags, new_addr);
+      if (result != MAP_FAILED) {
+         int saved_errno = errno;
+
+         pthread_mutex_lock (&log_lock);
+         if (enabled) {
+            int   i,n;
+            char *buffer;
+            void *bt [MAX_BT];
+
+            /* Get backtrace */
+            pthread_mutex_unlock (&log_lock);
+            n = backtrace (bt, MAX_BT);
+            pthread_mutex_lock (&log_lock);
+
+            /* Log operation and backtrace. */
+            buffer = log_buffer + LOG_HEADER_SIZE;
+            buffer = log_event (buffer, MREMAP);
+            buffer = log_ptr (buffer, addr);
+            buffer = log_u64 (buffer, old_len);
+            buffer = log_u64 (buffer, new_len);
+            buffer = log_ptr (buffer, result);
+            for (i = (skip + 1); i < n; i++) {
+               buffer = log_ptr (buffer, bt [i]);
+            }
+            log_write (buffer);
+         }
+         pthread_mutex_unlock (&log_lock);
+         errno = saved_errno;
+      }
+   }
+
+   leave ();
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+void *
+do_sbrk (intptr_t increment, int skip) {
+
+   unsigned int nested_level;
+   void *result;
+
+   TRACE3 (("called with increment=%d, skip=%d", (int) increment, skip));
+
+   nested_level = enter ();
+   if (libc_sbrk == 0) {
+      errno = ENOSYS;
+      result = (void *) -1;
+   }
+   else if ((nested_level > 1) || (increment == 0)) {
+      /* sbrk(0) only queries the current break. */
+      result = libc_sbrk (increment);
+   }
+   else {
+      result = libc_sbrk (increment);
+      if (result != (void *) -1) {
+         int saved_errno = errno;
+
+         pthread_mutex_lock (&log_lock);
+         if (enabled) {
+            int   i,n;
+            char *buffer;
+            void *bt [MAX_BT];
+
+            /* Get backtrace */
+            pthread_mutex_unlock (&log_lock);
+            n = backtrace (bt, MAX_BT);
+            pthread_mutex_lock (&log_lock);
+
+            /* Log operation and backtrace (the new break follows from the
+             * previous break and the signed increment). */
+            buffer = log_buffer + LOG_HEADER_SIZE;
+            buffer = log_event (buffer, SBRK);
+            buffer = log_u32 (buffer, increment);
+            buffer = log_ptr (buffer, result);
+            for (i = (skip + 1); i < n; i++) {
+               buffer = log_ptr (buffer, bt [i]);
+            }
+            log_write (buffer);
+         }
+         pthread_mutex_unlock (&log_lock);
+         errno = saved_errno;
+      }
+   }
+
+   leave ();
+   TRACE3 (("exiting with result=%p", result));
+   return result;
+}
+
+int
+do_brk (void *addr, int skip) {
+
+   unsigned int nested_level;
+   int result;
+
+   TRACE3 (("called with addr=%p, skip=%d", addr, skip));
+
+   nested_level = enter ();
+   if (libc_brk == 0) {
+      errno = ENOSYS;
+      result = -1;
+   }
+   else if (nested_level > 1) {
+      result = libc_brk (addr);
+   }
+   else {
+      result = libc_brk (addr);
+      if (result == 0) {
+         int saved_errno = errno;
+
+         pthread_mutex_lock (&log_lock);
+         if (enabled) {
+            int   i,n;
+            char *buffer;
+            void *bt [MAX_BT];
+
+            /* Get backtrace */
+            pthread_mutex_unlock (&log_lock);
+            n = backtrace (bt, MAX_BT);
+            pthread_mutex_lock (&log_lock);
+
+            /* Log operation and backtrace. */
+            buffer = log_buffer + LOG_HEADER_SIZE;
+            buffer = log_event (buffer, BRK);
+            buffer = log_ptr (buffer, addr);
+            for (i = (skip + 1); i < n; i++) {
+               buffer = log_ptr (buffer, bt [i]);
+            }
+            log_write (buffer);
+         }
+         pthread_mutex_unlock (&log_lock);
+         errno = saved_errno;
+      }
+   }
+
+   leave ();
+   TRACE3 (("exiting with result=%d", result));
+   return result;
+}
+
 void
 memtraq_enable (void) {
    pthread_mutex_lock (&log_lock);
@@ -511,3 +1167,74 @@ memtraq_tag (const char *name) {
    leave ();
 }
 
+void
+memtraq_context_push (const char *label) {
+
+   char *buffer;
+
+   /* A null label is logged as an empty one. */
+   if (label == 0) {
+      label = "";
+   }
+
+   enter ();
+   if ((check_initialized () == true) && (contexts == true)) {
+      context_stack_t *stack;
+
+      /* Stacks come from the internal pool as they are freed when their
+       * thread exits. */
+      stack = pthread_getspecific (context_key);
+      if (stack == 0) {
+         stack = lmm_alloc (sizeof (context_stack_t));
+         if (stack != 0) {
+            stack->depth = 0;
+            pthread_setspecific (context_key, stack);
+         }
+      }
+
+      if (stack != 0) {
+         unsigned int id;
+
+         /* Identifiers are only given to contexts logged with their label,
+          * allocations made in other contexts are accounted to the enclosing
+          * one. */
+         pthread_mutex_lock (&log_lock);
+         id = current_context ();
+         if (enabled) {
+            context_serial ++;
+            id = context_serial;
+
+            /* Insert context into log. */
+            buffer = log_buffer + LOG_HEADER_SIZE;
+            buffer = log_event (buffer, CONTEXT);
+            buffer = log_u32 (buffer, id);
+            buffer = log_strn (buffer, label, MAX_CONTEXT_LABEL);
+            log_write (buffer);
+         }
+         pthread_mutex_unlock (&log_lock);
+
+         if (stack->depth < MAX_CONTEXT_DEPTH) {
+            stack->ids [stack->depth] = id;
+         }
+         stack->depth ++;
+      }
+   }
+
+   leave ();
+}
+
+void
+memtraq_context_pop (void) {
+
+   enter ();
+   if ((check_initialized () == true) && (contexts == true)) {
+      context_stack_t *stack;
+
+      stack = pthread_getspecific (context_key);
+      if ((stack != 0) && (stack->depth > 0)) {
+         stack->depth --;
+      }
+   }
+
+   leave ();
+}